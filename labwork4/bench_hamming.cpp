@@ -0,0 +1,177 @@
+#include <benchmark/benchmark.h>
+#include "hamming.h"
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <span>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Buffer sizes run from 64 B to 1 GiB; error rates are flipped bits per
+// million encoded bits.
+const std::vector<int64_t> kSizes = {64, 4 << 10, 256 << 10, 16 << 20, 1 << 30};
+const std::vector<int64_t> kStreamSizes = {256 << 10, 16 << 20, 1 << 30};
+const std::vector<int64_t> kErrorRates = {0, 1, 100, 10000};
+const std::vector<int64_t> kKernels = {hammingcoder::kKernelScalar, hammingcoder::kKernelSse41,
+                                       hammingcoder::kKernelAvx2, hammingcoder::kKernelAvx512};
+
+class NullBuffer : public std::streambuf {
+protected:
+	int overflow(int c) override { return c; }
+	std::streamsize xsputn(const char*, std::streamsize n) override { return n; }
+};
+
+std::vector<char> RandomBytes(size_t size) {
+	std::mt19937_64 rng(size);
+	std::vector<char> data(size);
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8) {
+		uint64_t word = rng();
+		std::memcpy(data.data() + i, &word, 8);
+	}
+	for (; i < size; i++) {
+		data[i] = static_cast<char>(rng());
+	}
+	return data;
+}
+
+void Corrupt(std::span<char> encoded, int64_t per_million) {
+	if (per_million == 0) {
+		return;
+	}
+	std::mt19937_64 rng(per_million);
+	uint64_t bits = static_cast<uint64_t>(encoded.size()) * 8;
+	uint64_t flips = bits * per_million / 1000000;
+	std::uniform_int_distribution<size_t> byte(0, encoded.size() - 1);
+	std::uniform_int_distribution<int> bit(0, 7);
+	for (uint64_t i = 0; i < flips; i++) {
+		encoded[byte(rng)] ^= static_cast<char>(1 << bit(rng));
+	}
+}
+
+// Selects the kernel under test for one benchmark and restores the
+// auto-detected one afterwards.
+class KernelScope {
+public:
+	KernelScope(benchmark::State& state, int64_t kernel) : previous_(hammingcoder::ActiveKernel()) {
+		ok_ = hammingcoder::SelectKernel(static_cast<hammingcoder::Kernel>(kernel));
+		if (!ok_) {
+			state.SkipWithError("kernel not supported on this CPU");
+		}
+	}
+	~KernelScope() { hammingcoder::SelectKernel(previous_); }
+	bool ok() const { return ok_; }
+
+private:
+	hammingcoder::Kernel previous_;
+	bool ok_;
+};
+
+void BM_CodeByte(benchmark::State& state) {
+	for (auto _ : state) {
+		for (int value = 0; value < 256; value++) {
+			benchmark::DoNotOptimize(hammingcoder::CodeByte(static_cast<char>(value)));
+		}
+	}
+	state.SetBytesProcessed(state.iterations() * 256);
+}
+BENCHMARK(BM_CodeByte);
+
+void BM_DecodeByte(benchmark::State& state) {
+	std::vector<std::pair<char, char>> codes;
+	for (int value = 0; value < 256; value++) {
+		codes.push_back(hammingcoder::CodeByte(static_cast<char>(value)));
+	}
+	bool single_error, double_error, parity_error;
+	for (auto _ : state) {
+		for (const auto& [first, second] : codes) {
+			benchmark::DoNotOptimize(hammingcoder::DecodeByte(first, second, single_error, double_error, parity_error));
+		}
+	}
+	state.SetBytesProcessed(state.iterations() * 256);
+}
+BENCHMARK(BM_DecodeByte);
+
+void BM_EncodeBuffer(benchmark::State& state) {
+	KernelScope kernel(state, state.range(1));
+	if (!kernel.ok()) {
+		return;
+	}
+	std::vector<char> data = RandomBytes(state.range(0));
+	for (auto _ : state) {
+		std::vector<char> encoded = hammingcoder::EncodeBuffer(data.data(), data.size());
+		benchmark::DoNotOptimize(encoded.data());
+	}
+	state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_EncodeBuffer)->ArgNames({"size", "kernel"})->ArgsProduct({kSizes, kKernels});
+
+void BM_DecodeBuffer(benchmark::State& state) {
+	KernelScope kernel(state, state.range(2));
+	if (!kernel.ok()) {
+		return;
+	}
+	std::vector<char> encoded = hammingcoder::EncodeBuffer(RandomBytes(state.range(0)).data(), state.range(0));
+	Corrupt(encoded, state.range(1));
+	int correct = 0, uncorrect = 0;
+	for (auto _ : state) {
+		std::vector<char> decoded = hammingcoder::DecodeBuffer(encoded.data(), encoded.size(), correct, uncorrect);
+		benchmark::DoNotOptimize(decoded.data());
+	}
+	state.SetBytesProcessed(state.iterations() * state.range(0));
+	state.counters["corrected"] = correct;
+}
+BENCHMARK(BM_DecodeBuffer)->ArgNames({"size", "ppm", "kernel"})->ArgsProduct({kSizes, kErrorRates, kKernels});
+
+void BM_EncodeStream(benchmark::State& state) {
+	std::istringstream input;
+	{
+		std::vector<char> data = RandomBytes(state.range(0));
+		input.str(std::string(data.begin(), data.end()));
+	}
+	NullBuffer sink;
+	std::ostream output(&sink);
+	hammingcoder::StreamOptions options;
+	options.threads = static_cast<unsigned>(state.range(1));
+	for (auto _ : state) {
+		input.clear();
+		input.seekg(0);
+		hammingcoder::EncodeStream(input, output, nullptr, options);
+	}
+	state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_EncodeStream)->ArgNames({"size", "threads"})->ArgsProduct({kStreamSizes, {1, 2, 4}})
+	->UseRealTime()->Unit(benchmark::kMillisecond);
+
+void BM_DecodeStream(benchmark::State& state) {
+	std::string encoded(2 * state.range(0), '\0');
+	{
+		std::vector<char> data = RandomBytes(state.range(0));
+		hammingcoder::EncodeInto(std::as_bytes(std::span(data)), std::as_writable_bytes(std::span(encoded)));
+	}
+	Corrupt(encoded, state.range(1));
+	std::istringstream input(std::move(encoded));
+	NullBuffer sink;
+	std::ostream output(&sink);
+	hammingcoder::StreamOptions options;
+	options.threads = static_cast<unsigned>(state.range(2));
+	hammingcoder::DecodeReport report;
+	for (auto _ : state) {
+		input.clear();
+		input.seekg(0);
+		report = {};
+		hammingcoder::DecodeStream(input, output, report, options);
+	}
+	state.SetBytesProcessed(state.iterations() * state.range(0));
+	state.counters["corrected"] = report.corrected;
+}
+BENCHMARK(BM_DecodeStream)->ArgNames({"size", "ppm", "threads"})
+	->ArgsProduct({kStreamSizes, kErrorRates, {1, 2, 4}})->UseRealTime()->Unit(benchmark::kMillisecond);
+
+} // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,108 @@
+#include "checksum.h"
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+namespace {
+
+constexpr uint64_t kPrime1 = 0x9E3779B185EBCA87ULL;
+constexpr uint64_t kPrime2 = 0xC2B2AE3D27D4EB4FULL;
+constexpr uint64_t kPrime3 = 0x165667B19E3779F9ULL;
+constexpr uint64_t kPrime4 = 0x85EBCA77C2B2AE63ULL;
+constexpr uint64_t kPrime5 = 0x27D4EB2F165667C5ULL;
+
+// Like the archive records, words are read in host order, which matches
+// the reference XXH64 on the little-endian targets this builds for.
+uint64_t Load64(const std::byte* data) {
+    uint64_t value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+uint32_t Load32(const std::byte* data) {
+    uint32_t value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+uint64_t Round(uint64_t lane, uint64_t input) {
+    return std::rotl(lane + input * kPrime2, 31) * kPrime1;
+}
+
+uint64_t MergeLane(uint64_t hash, uint64_t lane) {
+    return (hash ^ Round(0, lane)) * kPrime1 + kPrime4;
+}
+
+void ConsumeStripe(std::array<uint64_t, 4>& lanes, const std::byte* stripe) {
+    for (size_t i = 0; i < 4; i++)
+        lanes[i] = Round(lanes[i], Load64(stripe + 8 * i));
+}
+
+} // namespace
+
+namespace hammingcoder {
+
+XxHash64::XxHash64()
+    : lanes_{kPrime1 + kPrime2, kPrime2, 0, 0 - kPrime1} {}
+
+void XxHash64::Update(std::span<const std::byte> data) {
+    // An empty span may have no data pointer, which memcpy must not get.
+    if (data.empty())
+        return;
+    total_ += data.size();
+    if (buffered_ > 0) {
+        size_t take = std::min(stripe_.size() - buffered_, data.size());
+        std::memcpy(stripe_.data() + buffered_, data.data(), take);
+        buffered_ += take;
+        data = data.subspan(take);
+        if (buffered_ < stripe_.size())
+            return;
+        ConsumeStripe(lanes_, stripe_.data());
+        buffered_ = 0;
+    }
+    while (data.size() >= stripe_.size()) {
+        ConsumeStripe(lanes_, data.data());
+        data = data.subspan(stripe_.size());
+    }
+    std::memcpy(stripe_.data(), data.data(), data.size());
+    buffered_ = data.size();
+}
+
+uint64_t XxHash64::Digest() const {
+    uint64_t hash;
+    if (total_ >= stripe_.size()) {
+        hash = std::rotl(lanes_[0], 1) + std::rotl(lanes_[1], 7) + std::rotl(lanes_[2], 12) + std::rotl(lanes_[3], 18);
+        for (uint64_t lane : lanes_)
+            hash = MergeLane(hash, lane);
+    } else {
+        hash = kPrime5;
+    }
+    hash += total_;
+
+    const std::byte* tail = stripe_.data();
+    size_t left = buffered_;
+    for (; left >= 8; tail += 8, left -= 8)
+        hash = std::rotl(hash ^ Round(0, Load64(tail)), 27) * kPrime1 + kPrime4;
+    if (left >= 4) {
+        hash = std::rotl(hash ^ (Load32(tail) * kPrime1), 23) * kPrime2 + kPrime3;
+        tail += 4;
+        left -= 4;
+    }
+    for (; left > 0; tail++, left--)
+        hash = std::rotl(hash ^ (std::to_integer<uint64_t>(*tail) * kPrime5), 11) * kPrime1;
+
+    hash ^= hash >> 33;
+    hash *= kPrime2;
+    hash ^= hash >> 29;
+    hash *= kPrime3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+uint64_t HashBytes(std::span<const std::byte> data) {
+    XxHash64 hash;
+    hash.Update(data);
+    return hash.Digest();
+}
+
+} // namespace hammingcoder
@@ -0,0 +1,29 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+namespace hammingcoder {
+    // Streaming XXH64 with seed 0: Update() any number of times, then
+    // Digest(), which leaves the state untouched.
+    class XxHash64 {
+    public:
+        XxHash64();
+
+        void Update(std::span<const std::byte> data);
+        uint64_t Digest() const;
+
+    private:
+        std::array<uint64_t, 4> lanes_;
+        std::array<std::byte, 32> stripe_;
+        size_t buffered_ = 0;
+        uint64_t total_ = 0;
+    };
+
+    uint64_t HashBytes(std::span<const std::byte> data);
+}
+
+#endif
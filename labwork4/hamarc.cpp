@@ -1,22 +1,408 @@
 #include "hamarc.h"
 #include "hamming.h"
+#include "checksum.h"
+#include <algorithm>
 #include <cstddef>
 #include <iostream>
 #include <fstream>
 #include <vector>
 #include <string>
-#include <map>
+#include <memory>
 #include <cstring>
 #include <cstdio>
+#include <atomic>
+#include <filesystem>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <unordered_map>
+#include <thread>
+#include <span>
 #ifdef _WIN32
 #include <windows.h>
 #else
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #endif
+#ifdef HAMARC_HAVE_ZLIB
+#include <zlib.h>
+#endif
 
 namespace hamarc{
 
+namespace {
+const size_t kChunkSize = 1 << 20;
+const size_t kSplitChunks = 64;   // members larger than this many chunks are split into parallel pieces
+const size_t kVerifyChunks = 8;   // chunks per verification task
+const unsigned kSnapshotInterval = 32;   // index blocks per snapshot: a longer chain costs lookups, a shorter one space
+
+// Reads and writes at absolute offsets without a shared file position.
+class PositionalFile {
+public:
+    // `create` makes a new empty file, replacing an existing one.
+    explicit PositionalFile(const std::string& path, bool create = false) {
+    #ifdef _WIN32
+        path_ = path;
+        file_.open(path, std::ios::binary | std::ios::in | std::ios::out | (create ? std::ios::trunc : std::ios::openmode{}));
+    #else
+        fd_ = create ? open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644) : open(path.c_str(), O_RDWR);
+    #endif
+    }
+
+    ~PositionalFile() {
+    #ifndef _WIN32
+        if (fd_ >= 0) {
+            close(fd_);
+        }
+    #endif
+    }
+
+    PositionalFile(const PositionalFile&) = delete;
+    PositionalFile& operator=(const PositionalFile&) = delete;
+
+    bool IsOpen() const {
+    #ifdef _WIN32
+        return file_.is_open();
+    #else
+        return fd_ >= 0;
+    #endif
+    }
+
+    bool ReadAt(void* data, size_t size, unsigned long long offset) {
+    #ifdef _WIN32
+        std::lock_guard<std::mutex> lock(mutex_);
+        file_.seekg(offset);
+        file_.read(static_cast<char*>(data), size);
+        return file_.gcount() == static_cast<std::streamsize>(size);
+    #else
+        auto out = static_cast<char*>(data);
+        while (size > 0) {
+            ssize_t done = pread(fd_, out, size, static_cast<off_t>(offset));
+            if (done <= 0) {
+                return false;
+            }
+            out += done;
+            offset += done;
+            size -= done;
+        }
+        return true;
+    #endif
+    }
+
+    bool WriteAt(const void* data, size_t size, unsigned long long offset) {
+    #ifdef _WIN32
+        std::lock_guard<std::mutex> lock(mutex_);
+        file_.seekp(offset);
+        file_.write(static_cast<const char*>(data), size);
+        return static_cast<bool>(file_);
+    #else
+        auto in = static_cast<const char*>(data);
+        while (size > 0) {
+            ssize_t done = pwrite(fd_, in, size, static_cast<off_t>(offset));
+            if (done <= 0) {
+                return false;
+            }
+            in += done;
+            offset += done;
+            size -= done;
+        }
+        return true;
+    #endif
+    }
+
+    // Copies [offset, offset + size) into `target` at `target_offset`,
+    // inside the kernel where copy_file_range is available.
+    bool CopyTo(PositionalFile& target, unsigned long long offset, unsigned long long size,
+                unsigned long long target_offset) {
+    #ifdef __linux__
+        while (size > 0) {
+            loff_t in = static_cast<loff_t>(offset);
+            loff_t out = static_cast<loff_t>(target_offset);
+            ssize_t done = copy_file_range(fd_, &in, target.fd_, &out,
+                                           static_cast<size_t>(std::min<unsigned long long>(size, 1ull << 30)), 0);
+            if (done <= 0) {
+                break;   // not supported here, or a short source; the loop below sorts it out
+            }
+            offset += done;
+            target_offset += done;
+            size -= done;
+        }
+    #endif
+        std::vector<char> chunk(static_cast<size_t>(std::min<unsigned long long>(size, kChunkSize)));
+        while (size > 0) {
+            size_t want = static_cast<size_t>(std::min<unsigned long long>(size, chunk.size()));
+            if (!ReadAt(chunk.data(), want, offset) || !target.WriteAt(chunk.data(), want, target_offset)) {
+                return false;
+            }
+            offset += want;
+            target_offset += want;
+            size -= want;
+        }
+        return true;
+    }
+
+    unsigned long long Size() {
+    #ifdef _WIN32
+        std::lock_guard<std::mutex> lock(mutex_);
+        file_.seekg(0, std::ios::end);
+        return static_cast<unsigned long long>(file_.tellg());
+    #else
+        struct stat info;
+        return fstat(fd_, &info) == 0 ? static_cast<unsigned long long>(info.st_size) : 0;
+    #endif
+    }
+
+    bool Sync() {
+    #ifdef _WIN32
+        file_.flush();
+        return static_cast<bool>(file_);
+    #else
+        return fsync(fd_) == 0;
+    #endif
+    }
+
+    bool Truncate(unsigned long long size) {
+    #ifdef _WIN32
+        std::lock_guard<std::mutex> lock(mutex_);
+        file_.flush();
+        std::error_code error;
+        std::filesystem::resize_file(path_, size, error);
+        return !error;
+    #else
+        return ftruncate(fd_, static_cast<off_t>(size)) == 0;
+    #endif
+    }
+
+private:
+#ifdef _WIN32
+    std::string path_;
+    std::fstream file_;
+    std::mutex mutex_;   // seek and transfer must not interleave between threads
+#else
+    int fd_ = -1;
+#endif
+};
+}
+
+ArchiveReader::ArchiveReader(const std::string& path){
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                              FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE){
+        return;
+    }
+    file_ = file;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)){
+        return;
+    }
+    size_ = static_cast<unsigned long long>(size.QuadPart);
+    if (size_ != 0){
+        mapping_ = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (!mapping_){
+            return;
+        }
+        data_ = static_cast<const std::byte*>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+        if (!data_){
+            return;
+        }
+    }
+    open_ = true;
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0){
+        return;
+    }
+    struct stat info;
+    if (fstat(fd, &info) == 0){
+        size_ = static_cast<unsigned long long>(info.st_size);
+        if (size_ == 0){
+            open_ = true;
+        } else{
+            void* data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED){
+                data_ = static_cast<const std::byte*>(data);
+                open_ = true;
+            }
+        }
+    }
+    close(fd);
+#endif
+}
+
+ArchiveReader::~ArchiveReader(){
+#ifdef _WIN32
+    if (data_){
+        UnmapViewOfFile(data_);
+    }
+    if (mapping_){
+        CloseHandle(mapping_);
+    }
+    if (file_){
+        CloseHandle(file_);
+    }
+#else
+    if (data_){
+        munmap(const_cast<std::byte*>(data_), size_);
+    }
+#endif
+}
+
+std::span<const std::byte> ArchiveReader::Range(unsigned long long offset, unsigned long long size) const{
+    if (offset > size_ || size > size_ - offset){
+        return {};
+    }
+    return std::span(data_ + offset, static_cast<size_t>(size));
+}
+
+void ArchiveReader::WillRead(unsigned long long offset, unsigned long long size) const{
+#ifndef _WIN32
+    if (!data_ || offset >= size_){
+        return;
+    }
+    static const unsigned long long page = static_cast<unsigned long long>(sysconf(_SC_PAGESIZE));
+    unsigned long long start = offset / page * page;
+    size_t length = static_cast<size_t>(std::min(size_, offset + size) - start);
+    void* address = const_cast<std::byte*>(data_ + start);
+    madvise(address, length, MADV_SEQUENTIAL);
+    madvise(address, length, MADV_WILLNEED);
+#endif
+}
+
+namespace {
+const size_t kNameBlockSize = 64 << 10;
+}
+
+MemberIndex::MemberIndex(const MemberIndex& other){
+    *this = other;
+}
+
+MemberIndex& MemberIndex::operator=(const MemberIndex& other){
+    if (this == &other){
+        return *this;
+    }
+    Clear();
+    for (const MemberEntry& entry : other.entries_){
+        Insert(entry);
+    }
+    return *this;
+}
+
+size_t MemberIndex::Home(std::string_view name) const{
+    return std::hash<std::string_view>{}(name) & (slots_.size() - 1);
+}
+
+size_t MemberIndex::SlotOf(std::string_view name) const{
+    size_t slot = Home(name);
+    while (slots_[slot] != 0 && entries_[slots_[slot] - 1].name != name){
+        slot = (slot + 1) & (slots_.size() - 1);
+    }
+    return slot;
+}
+
+const MemberEntry* MemberIndex::Find(std::string_view name) const{
+    if (slots_.empty()){
+        return nullptr;
+    }
+    size_t slot = SlotOf(name);
+    return slots_[slot] != 0 ? &entries_[slots_[slot] - 1] : nullptr;
+}
+
+void MemberIndex::Insert(const MemberEntry& entry){
+    const std::string_view name = entry.name;
+    if ((entries_.size() + 1) * 2 > slots_.size()){
+        Rehash(std::max<size_t>(16, slots_.size() * 2));
+    }
+
+    size_t slot = SlotOf(name);
+    if (slots_[slot] == 0){
+        MemberEntry added = {};
+        added.name = StoreName(name);
+        entries_.push_back(added);
+        slots_[slot] = static_cast<unsigned int>(entries_.size());
+    }
+    MemberEntry& member = entries_[slots_[slot] - 1];
+    member.originalSize = entry.originalSize;
+    member.encodedSize = entry.encodedSize;
+    member.offset = entry.offset;
+    member.contentHash = entry.contentHash;
+    member.compression = entry.compression;
+}
+
+bool MemberIndex::Erase(std::string_view name){
+    if (slots_.empty()){
+        return false;
+    }
+    size_t hole = SlotOf(name);
+    if (slots_[hole] == 0){
+        return false;
+    }
+    size_t index = slots_[hole] - 1;
+
+    // Backward-shift deletion keeps every probe chain unbroken without tombstones.
+    const size_t mask = slots_.size() - 1;
+    for (size_t next = (hole + 1) & mask; slots_[next] != 0; next = (next + 1) & mask){
+        size_t home = Home(entries_[slots_[next] - 1].name);
+        bool movable = hole <= next ? (home <= hole || home > next) : (home <= hole && home > next);
+        if (movable){
+            slots_[hole] = slots_[next];
+            hole = next;
+        }
+    }
+    slots_[hole] = 0;
+
+    // The last entry fills the gap; its name stays in the arena until Clear().
+    size_t last = entries_.size() - 1;
+    if (index != last){
+        size_t slot = Home(entries_[last].name);
+        while (slots_[slot] != last + 1){
+            slot = (slot + 1) & mask;
+        }
+        entries_[index] = entries_[last];
+        slots_[slot] = static_cast<unsigned int>(index + 1);
+    }
+    entries_.pop_back();
+    return true;
+}
+
+void MemberIndex::Clear(){
+    entries_.clear();
+    slots_.clear();
+    blocks_.clear();
+    block_used_ = 0;
+}
+
+std::vector<const MemberEntry*> MemberIndex::SortedByName() const{
+    std::vector<const MemberEntry*> sorted;
+    sorted.reserve(entries_.size());
+    for (const MemberEntry& entry : entries_){
+        sorted.push_back(&entry);
+    }
+    std::sort(sorted.begin(), sorted.end(),
+              [](const MemberEntry* a, const MemberEntry* b) { return a->name < b->name; });
+    return sorted;
+}
+
+std::string_view MemberIndex::StoreName(std::string_view name){
+    if (blocks_.empty() || block_used_ + name.size() > kNameBlockSize){
+        blocks_.push_back(std::make_unique<char[]>(std::max(kNameBlockSize, name.size())));
+        block_used_ = 0;
+    }
+    char* stored = blocks_.back().get() + block_used_;
+    std::memcpy(stored, name.data(), name.size());
+    block_used_ += name.size();
+    return std::string_view(stored, name.size());
+}
+
+void MemberIndex::Rehash(size_t capacity){
+    slots_.assign(capacity, 0);
+    for (size_t i = 0; i < entries_.size(); i++){
+        slots_[SlotOf(entries_[i].name)] = static_cast<unsigned int>(i + 1);
+    }
+}
+
 std::vector<char> EncodeHeader(const FileHeader& header) {
     std::vector<char> raw_data(sizeof(FileHeader));
     std::memcpy(raw_data.data(), &header, sizeof(FileHeader));
@@ -49,6 +435,167 @@ FileEntry DecodeFileEntry(const char* encoded_data) {
     return entry;
 }
 
+hammingcoder::StreamOptions PayloadOptions(const ArchiveState& state) {
+    hammingcoder::StreamOptions options;
+    options.codec = state.codec;
+    options.interleave = state.interleave;
+    return options;
+}
+
+CreateOptions OptionsOf(const ArchiveState& state) {
+    CreateOptions options;
+    options.codec = state.codec;
+    options.interleave = state.interleave;
+    options.compression = state.compression;
+    options.progress = state.progress;
+    return options;
+}
+
+hammingcoder::ProgressCallback ProgressFor(const ArchiveState& state, const std::string& filename) {
+    if (!state.progress) {
+        return nullptr;
+    }
+    return [&state, filename](const hammingcoder::StreamProgress& progress) { state.progress(filename, progress); };
+}
+
+template <typename T>
+std::vector<char> EncodeRecord(const T& value) {
+    return hammingcoder::EncodeBuffer(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+// Fails when a codeword is uncorrectable, so damaged metadata is never
+// taken at face value.
+template <typename T>
+bool DecodeRecord(const char* encoded_data, T& value) {
+    int correct = 0, uncorrect = 0;
+    std::vector<char> decoded = hammingcoder::DecodeBuffer(encoded_data, 2 * sizeof(T), correct, uncorrect);
+    if (uncorrect != 0 || decoded.size() < sizeof(T)) {
+        return false;
+    }
+    std::memcpy(&value, decoded.data(), sizeof(T));
+    return true;
+}
+
+// New archives are always written in kFormatLog.
+std::vector<char> EncodeArchiveHeader(const CreateOptions& options) {
+    FileHeader header = {};
+    header.magic[3] = kFormatLog;
+    std::vector<char> encoded = EncodeHeader(header);
+    CodecHeader codec_header = {};
+    codec_header.codec = options.codec;
+    codec_header.interleave = static_cast<unsigned char>(options.interleave);
+    codec_header.compression = options.compression;
+    std::vector<char> encoded_codec = EncodeRecord(codec_header);
+    encoded.insert(encoded.end(), encoded_codec.begin(), encoded_codec.end());
+    return encoded;
+}
+
+// One add or remove record of an index block while it is being written.
+struct MemberRecord {
+    std::string name;
+    unsigned long long originalSize;
+    unsigned long long encodedSize;
+    unsigned long long offset;
+    unsigned long long contentHash;
+    Compression compression;
+    RecordKind kind;
+};
+
+// An index block at `offset` with its footer right behind it.
+std::vector<char> EncodeIndex(const std::vector<MemberRecord>& records, unsigned long long previous,
+                              unsigned long long offset, char kind = kIndexDelta) {
+    std::string names;
+    std::vector<char> encoded_records;
+    for (const MemberRecord& member : records) {
+        IndexRecord record = {};
+        record.originalSize = member.originalSize;
+        record.encodedSize = member.encodedSize;
+        record.offset = member.offset;
+        record.contentHash = member.contentHash;
+        record.nameOffset = static_cast<unsigned int>(names.size());
+        record.nameSize = static_cast<unsigned int>(member.name.size());
+        record.kind = member.kind;
+        record.compression = member.compression;
+        names += member.name;
+        std::vector<char> encoded_record = EncodeRecord(record);
+        encoded_records.insert(encoded_records.end(), encoded_record.begin(), encoded_record.end());
+    }
+
+    IndexHeader header = {};
+    header.magic[3] = kind;
+    header.recordCount = static_cast<unsigned int>(records.size());
+    header.previous = previous;
+    header.namesSize = names.size();
+    std::vector<char> encoded = EncodeRecord(header);
+    encoded.insert(encoded.end(), encoded_records.begin(), encoded_records.end());
+    std::vector<char> encoded_names = hammingcoder::EncodeBuffer(names.data(), names.size());
+    encoded.insert(encoded.end(), encoded_names.begin(), encoded_names.end());
+    Footer footer = {};
+    footer.index = offset;
+    std::vector<char> encoded_footer = EncodeRecord(footer);
+    encoded.insert(encoded.end(), encoded_footer.begin(), encoded_footer.end());
+    return encoded;
+}
+
+bool IsIndexHeader(const IndexHeader& header) {
+    return std::string(header.magic, 3) == "HAI" &&
+           (header.magic[3] == kIndexDelta || header.magic[3] == kIndexSnapshot);
+}
+
+unsigned long long IndexBlockSize(const IndexHeader& header) {
+    return sizeof(EncodedIndexHeader) + static_cast<unsigned long long>(header.recordCount) * sizeof(EncodedIndexRecord)
+           + 2 * header.namesSize + sizeof(EncodedFooter);
+}
+
+// Sorts add records by name for a snapshot block, keeping the last record
+// of each name.
+std::vector<MemberRecord> SnapshotRecords(std::vector<MemberRecord> records) {
+    std::stable_sort(records.begin(), records.end(), [](const MemberRecord& a, const MemberRecord& b) {
+        return a.name < b.name;
+    });
+    std::vector<MemberRecord> snapshot;
+    for (MemberRecord& record : records) {
+        if (!snapshot.empty() && snapshot.back().name == record.name) {
+            snapshot.back() = std::move(record);
+        } else {
+            snapshot.push_back(std::move(record));
+        }
+    }
+    return snapshot;
+}
+
+void ApplyRecord(ArchiveState& state, std::string_view name, const IndexRecord& record) {
+    if (record.kind == kRecordRemove) {
+        state.files.Erase(name);
+    } else {
+        state.files.Insert({name, record.originalSize, record.encodedSize, record.offset, record.contentHash,
+                            static_cast<Compression>(record.compression)});
+    }
+}
+
+bool DecodeNames(const char* encoded_names, unsigned long long size, std::string& names) {
+    int correct = 0, uncorrect = 0;
+    std::vector<char> decoded = hammingcoder::DecodeBuffer(encoded_names, 2 * size, correct, uncorrect);
+    names.assign(decoded.begin(), decoded.end());
+    return uncorrect == 0;
+}
+
+// Deduplicated members point at one payload. An empty member can sit at the
+// offset of the member after it without sharing anything, so the size
+// must match too.
+bool SharesPayload(const MemberEntry& a, const MemberEntry& b) {
+    return a.offset == b.offset && a.encodedSize == b.encodedSize;
+}
+
+bool ByPayload(const MemberEntry& a, const MemberEntry& b) {
+    return a.offset != b.offset ? a.offset < b.offset : a.encodedSize < b.encodedSize;
+}
+
+MemberRecord MakeRecord(const MemberEntry& entry, RecordKind kind) {
+    return {std::string(entry.name), entry.originalSize, entry.encodedSize, entry.offset, entry.contentHash,
+            entry.compression, kind};
+}
+
 bool FileExist(const std::string& path){
     std::ifstream file(path);
     return file.good();
@@ -59,170 +606,1007 @@ std::string GetFilename(const std::string& path){
     if (pos == std::string::npos){
         return path;
     }
-    return path.substr(pos+1);
+    return path.substr(pos+1);
+}
+
+bool RenameFile(const std::string& old_path, const std::string& new_path){
+    return std::rename(old_path.c_str(), new_path.c_str()) == 0;
+}
+
+bool MakeDirectory(const std::string& path){
+    #ifdef _WIN32
+        return CreateDirectoryA(path.c_str(), NULL) != 0;
+    #else
+        return mkdir(path.c_str(), 0755) == 0;
+    #endif
+}
+
+void PrintDamage(const std::string& filename, const hammingcoder::DecodeReport& report){
+    std::cout << filename << ": " << report.uncorrectable << " uncorrectable, "
+              << report.corrected << " corrected codewords" << std::endl;
+    for (const auto& range : report.damaged){
+        std::cout << "  damaged archive bytes [" << range.offset << ", "
+                  << range.offset + range.length << ")" << std::endl;
+    }
+}
+
+// `read_at` returns `size` encoded bytes at `offset`, or nullptr when they
+// lie outside the archive of `archive_size` bytes.
+using DirectoryReader = std::function<const char*(unsigned long long offset, size_t size)>;
+
+// Whether a footer at `offset` decodes and closes the index block it
+// points at, which must end right where the footer begins.
+bool IsFooterAt(const DirectoryReader& read_at, unsigned long long offset, unsigned long long start, Footer& footer){
+    const char* encoded_footer = read_at(offset, sizeof(EncodedFooter));
+    if (!encoded_footer || !DecodeRecord(encoded_footer, footer) ||
+        std::string(footer.magic, 4) != std::string(Footer{}.magic, 4)) {
+        return false;
+    }
+    if (footer.index == 0) {
+        return offset == start;
+    }
+    if (footer.index < start || footer.index >= offset) {
+        return false;
+    }
+    const char* encoded_index = read_at(footer.index, sizeof(EncodedIndexHeader));
+    IndexHeader header;
+    return encoded_index && DecodeRecord(encoded_index, header) && IsIndexHeader(header) &&
+           header.namesSize <= offset && footer.index + IndexBlockSize(header) == offset + sizeof(EncodedFooter);
+}
+
+bool ReadFooter(const DirectoryReader& read_at, unsigned long long archive_size, unsigned long long start,
+                ArchiveState& state){
+    if (archive_size < start + sizeof(EncodedFooter)) {
+        return false;
+    }
+    Footer footer;
+    unsigned long long position = archive_size - sizeof(EncodedFooter);
+    if (IsFooterAt(read_at, position, start, footer)) {
+        state.lastIndex = footer.index;
+        return true;
+    }
+
+    // An append cut short by a crash leaves payload bytes or part of an
+    // index block behind the last complete footer. Everything up to that
+    // footer is intact, so search backwards for it.
+    const std::vector<char> magic = EncodeRecord(Footer{});
+    const size_t magic_size = sizeof(EncodedFooter::encoded_magic);
+    std::vector<char> window;
+    while (position > start) {
+        unsigned long long low = position - std::min<unsigned long long>(position - start, kChunkSize);
+        const char* bytes = read_at(low, static_cast<size_t>(position - low + magic_size));
+        if (!bytes) {
+            return false;
+        }
+        // read_at may reuse its buffer, and IsFooterAt reads again.
+        window.assign(bytes, bytes + (position - low + magic_size));
+        for (unsigned long long candidate = position; candidate-- > low; ) {
+            if (std::memcmp(window.data() + (candidate - low), magic.data(), magic_size) == 0 &&
+                IsFooterAt(read_at, candidate, start, footer)) {
+                state.lastIndex = footer.index;
+                return true;
+            }
+        }
+        position = low;
+    }
+    return false;
+}
+
+bool ParseIndexChain(const DirectoryReader& read_at, unsigned long long archive_size, unsigned long long start,
+                     ArchiveState& state){
+    // Blocks only ever point backwards, which also rules out cycles.
+    std::vector<std::pair<unsigned long long, IndexHeader>> chain;
+    unsigned long long limit = archive_size;
+    state.deltaBlocks = 0;
+    for (unsigned long long offset = state.lastIndex; offset != 0; ) {
+        if (offset < start || offset >= limit) {
+            return false;
+        }
+        const char* encoded_index = read_at(offset, sizeof(EncodedIndexHeader));
+        if (!encoded_index) {
+            return false;
+        }
+        IndexHeader header;
+        if (!DecodeRecord(encoded_index, header) || !IsIndexHeader(header)) {
+            return false;
+        }
+        chain.emplace_back(offset, header);
+        state.deltaBlocks += header.magic[3] == kIndexDelta;
+        limit = offset;
+        offset = header.previous;
+    }
+
+    state.files.Clear();
+    for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+        const auto& [offset, header] = *it;
+        const unsigned long long records = offset + sizeof(EncodedIndexHeader);
+        const unsigned long long names_start = records + header.recordCount * sizeof(EncodedIndexRecord);
+        const char* encoded_names = header.namesSize == 0 ? "" : read_at(names_start, 2 * header.namesSize);
+        if (!encoded_names) {
+            return false;
+        }
+        std::string names;
+        if (!DecodeNames(encoded_names, header.namesSize, names)) {
+            return false;
+        }
+        for (unsigned int i = 0; i < header.recordCount; i++) {
+            const char* encoded_record = read_at(records + i * sizeof(EncodedIndexRecord), sizeof(EncodedIndexRecord));
+            if (!encoded_record) {
+                return false;
+            }
+            IndexRecord record;
+            if (!DecodeRecord(encoded_record, record) ||
+                static_cast<unsigned long long>(record.nameOffset) + record.nameSize > names.size()) {
+                return false;
+            }
+            ApplyRecord(state, std::string_view(names).substr(record.nameOffset, record.nameSize), record);
+        }
+        state.metadata.push_back({offset, IndexBlockSize(header)});
+    }
+    return true;
+}
+
+bool ParseDirectory(const DirectoryReader& read_at, unsigned long long archive_size, ArchiveState& state,
+                    bool load_index = true){
+    const char* encoded_header = read_at(0, sizeof(EncodedFileHeader));
+    if (!encoded_header) {
+        return false;
+    }
+    FileHeader header = DecodeHeader(encoded_header);
+    
+    if (std::string(header.magic, 3) != "HAF") {
+        return false;
+    }
+
+    state.format = header.magic[3];
+    state.indexLoaded = true;
+    state.codec = hammingcoder::kCodecHamming84;
+    state.interleave = 0;
+    state.compression = kCompressionNone;
+    state.lastIndex = 0;
+    state.deltaBlocks = 0;
+    state.metadata.clear();
+    unsigned long long position = sizeof(EncodedFileHeader);
+    if (header.magic[3] == kFormatCodec || header.magic[3] == kFormatLog) {
+        const char* encoded_codec = read_at(position, sizeof(EncodedCodecHeader));
+        if (!encoded_codec) {
+            return false;
+        }
+        position += sizeof(EncodedCodecHeader);
+
+        CodecHeader codec_header;
+        if (!DecodeRecord(encoded_codec, codec_header)) {
+            return false;
+        }
+        const hammingcoder::Codec* codec = hammingcoder::FindCodec(static_cast<hammingcoder::CodecId>(codec_header.codec));
+        if (!codec || !hammingcoder::IsValidInterleave(codec_header.interleave) ||
+            codec_header.compression > kCompressionDeflate) {
+            return false;
+        }
+        state.codec = codec->Id();
+        state.interleave = codec_header.interleave;
+        state.compression = static_cast<Compression>(codec_header.compression);
+    } else if (header.magic[3] != kFormatLegacy) {
+        return false;
+    }
+
+    if (header.magic[3] == kFormatLog) {
+        state.metadata.push_back({0, position});
+        state.files.Clear();
+        state.indexLoaded = load_index;
+        return ReadFooter(read_at, archive_size, position, state) &&
+               (!load_index || ParseIndexChain(read_at, archive_size, position, state));
+    }
+
+    state.files.Clear();
+    for (unsigned int i = 0; i < header.fileCount; i++) {
+        const char* encoded_entry = read_at(position, sizeof(EncodedFileEntry));
+        if (!encoded_entry) {
+            return false;
+        }
+        position += sizeof(EncodedFileEntry);
+
+        FileEntry entry = DecodeFileEntry(encoded_entry);
+        state.files.Insert({std::string_view(entry.filename, strnlen(entry.filename, sizeof(entry.filename))),
+                            entry.originalSize, entry.encodedSize, entry.offset, 0, kCompressionNone});
+    }
+    state.metadata.push_back({0, position});
+    
+    return true;
+}
+
+bool ValidateArchive(std::ifstream& file, ArchiveState& state){
+    file.seekg(0, std::ios::end);
+    unsigned long long archive_size = static_cast<unsigned long long>(file.tellg());
+    std::vector<char> buffer;
+    return ParseDirectory([&](unsigned long long offset, size_t size) -> const char* {
+        if (offset > archive_size || size > archive_size - offset) {
+            return nullptr;
+        }
+        buffer.resize(size);
+        file.clear();
+        file.seekg(offset);
+        file.read(buffer.data(), size);
+        return file.gcount() == static_cast<std::streamsize>(size) ? buffer.data() : nullptr;
+    }, archive_size, state);
+}
+
+const char* MappedBytes(const ArchiveReader& reader, unsigned long long offset, size_t size){
+    std::span<const std::byte> range = reader.Range(offset, size);
+    return range.empty() ? nullptr : reinterpret_cast<const char*>(range.data());
+}
+
+bool ValidateArchive(const ArchiveReader& reader, ArchiveState& state){
+    return ParseDirectory([&](unsigned long long offset, size_t size) { return MappedBytes(reader, offset, size); },
+                          reader.Size(), state);
+}
+
+bool FindMember(const ArchiveState& state, const ArchiveReader& reader, std::string_view name, MemberEntry& entry){
+    if (state.indexLoaded) {
+        const MemberEntry* member = state.files.Find(name);
+        if (!member) {
+            return false;
+        }
+        entry = *member;
+        entry.name = name;
+        return true;
+    }
+
+    unsigned long long limit = reader.Size();
+    for (unsigned long long offset = state.lastIndex; offset != 0 && offset < limit; ) {
+        const char* encoded_index = MappedBytes(reader, offset, sizeof(EncodedIndexHeader));
+        if (!encoded_index) {
+            return false;
+        }
+        IndexHeader header;
+        if (!DecodeRecord(encoded_index, header) || !IsIndexHeader(header)) {
+            return false;
+        }
+        const unsigned long long records = offset + sizeof(EncodedIndexHeader);
+        const unsigned long long names_start = records + header.recordCount * sizeof(EncodedIndexRecord);
+        // Decodes record i and only its own slice of the name blob.
+        IndexRecord record;
+        std::string record_name;
+        auto record_at = [&](size_t i) {
+            const char* encoded = MappedBytes(reader, records + i * sizeof(EncodedIndexRecord), sizeof(EncodedIndexRecord));
+            if (!encoded) {
+                return false;
+            }
+            if (!DecodeRecord(encoded, record) ||
+                static_cast<unsigned long long>(record.nameOffset) + record.nameSize > header.namesSize) {
+                return false;
+            }
+            const char* encoded_name = record.nameSize == 0 ? ""
+                : MappedBytes(reader, names_start + 2ULL * record.nameOffset, 2 * record.nameSize);
+            if (!encoded_name) {
+                return false;
+            }
+            return DecodeNames(encoded_name, record.nameSize, record_name);
+        };
+        auto found = [&]() {
+            entry = {name, record.originalSize, record.encodedSize, record.offset, record.contentHash,
+                     static_cast<Compression>(record.compression)};
+            return record.kind == kRecordAdd;
+        };
+
+        if (header.magic[3] == kIndexSnapshot) {
+            size_t low = 0, high = header.recordCount;
+            while (low < high) {
+                size_t middle = low + (high - low) / 2;
+                if (!record_at(middle)) {
+                    return false;
+                }
+                if (record_name < name) {
+                    low = middle + 1;
+                } else {
+                    high = middle;
+                }
+            }
+            if (low == header.recordCount || !record_at(low) || record_name != name) {
+                return false;
+            }
+            return found();
+        }
+
+        // Later records of a delta block override earlier ones.
+        for (size_t i = header.recordCount; i-- > 0; ) {
+            if (!record_at(i)) {
+                return false;
+            }
+            if (record_name == name) {
+                return found();
+            }
+        }
+        limit = offset;
+        offset = header.previous;
+    }
+    return false;
+}
+
+// Appends an index block holding `records` at the end of a kFormatLog
+// archive and applies the records to `state`. Every kSnapshotInterval-th
+// block is a snapshot of all members instead, so lookups and loads never
+// walk more than that many delta blocks.
+bool AppendIndex(ArchiveState& state, const std::vector<MemberRecord>& records){
+    PositionalFile archive(state.archivePath);
+    if (!archive.IsOpen()) {
+        return false;
+    }
+
+    MemberIndex files = state.files;
+    for (const MemberRecord& record : records) {
+        if (record.kind == kRecordRemove) {
+            files.Erase(record.name);
+        } else {
+            files.Insert({record.name, record.originalSize, record.encodedSize, record.offset, record.contentHash,
+                          record.compression});
+        }
+    }
+
+    // Payloads appended for these records reach the disk before the index
+    // that refers to them. A failed write is cut off again, so the old
+    // footer stays the last thing in the file.
+    unsigned long long offset = archive.Size();
+    const bool snapshot = state.deltaBlocks + 1 >= kSnapshotInterval;
+    std::vector<char> encoded;
+    if (snapshot) {
+        std::vector<MemberRecord> members;
+        for (const MemberEntry& entry : files) {
+            members.push_back(MakeRecord(entry, kRecordAdd));
+        }
+        encoded = EncodeIndex(SnapshotRecords(std::move(members)), 0, offset, kIndexSnapshot);
+    } else {
+        encoded = EncodeIndex(records, state.lastIndex, offset);
+    }
+    if (!archive.Sync() || !archive.WriteAt(encoded.data(), encoded.size(), offset) || !archive.Sync()) {
+        archive.Truncate(offset);
+        return false;
+    }
+
+    state.files = std::move(files);
+    state.lastIndex = offset;
+    state.deltaBlocks = snapshot ? 0 : state.deltaBlocks + 1;
+    state.metadata.push_back({offset, encoded.size()});
+    return true;
+}
+
+// Runs run(0) .. run(count - 1) on up to `threads` threads, including the
+// caller's; 0 picks hardware_concurrency(). Tasks are claimed in order.
+void RunTasks(size_t count, unsigned threads, const std::function<void(size_t)>& run){
+    if (threads == 0){
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threads = static_cast<unsigned>(std::min<size_t>(threads, count));
+
+    std::atomic<size_t> next_task{0};
+    auto worker = [&]() {
+        for (size_t task = next_task++; task < count; task = next_task++){
+            run(task);
+        }
+    };
+    std::vector<std::thread> pool;
+    for (unsigned i = 1; i < threads; i++){
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : pool){
+        thread.join();
+    }
+}
+
+using ByteWriter = std::function<bool(const std::byte* data, size_t size)>;
+
+// A member's contentHash is XXH64 over the little-endian XXH64 digests of
+// the consecutive kChunkSize pieces of its original data. Pieces hash on
+// their own, so parallel encoders and verifiers hash the pieces they hold
+// and only the digests are combined.
+unsigned long long CombineDigests(const std::vector<unsigned long long>& digests){
+    hammingcoder::XxHash64 hash;
+    for (unsigned long long digest : digests) {
+        std::byte bytes[8];
+        for (size_t i = 0; i < sizeof(bytes); i++) {
+            bytes[i] = static_cast<std::byte>(digest >> (8 * i));
+        }
+        hash.Update(bytes);
+    }
+    return hash.Digest();
 }
 
-bool RenameFile(const std::string& old_path, const std::string& new_path){
-    return std::rename(old_path.c_str(), new_path.c_str()) == 0;
+// Number of kChunkSize pieces in `size` bytes of original data.
+size_t PieceCount(unsigned long long size){
+    return static_cast<size_t>((size + kChunkSize - 1) / kChunkSize);
 }
 
-bool MakeDirectory(const std::string& path){
-    #ifdef _WIN32
-        return CreateDirectoryA(path.c_str(), NULL) != 0;
-    #else
-        return mkdir(path.c_str(), 0755) == 0;
-    #endif
+// Hashes original data at `offset` into its pieces' digests. The data must
+// start on a piece boundary and may end short of one only at the end of
+// the member.
+void HashPieces(std::vector<unsigned long long>& digests, const std::byte* data, size_t size,
+                unsigned long long offset){
+    for (size_t done = 0; done < size; done += kChunkSize) {
+        digests[static_cast<size_t>((offset + done) / kChunkSize)] =
+            hammingcoder::HashBytes(std::span(data + done, std::min(kChunkSize, size - done)));
+    }
 }
 
-bool ValidateArchive(std::ifstream& file, ArchiveState& state){
-    EncodedFileHeader encoded_header;
-    file.read(reinterpret_cast<char*>(&encoded_header), sizeof(encoded_header));
-    
-    if (file.gcount() != sizeof(encoded_header)) {
-        return false;
+// Computes a contentHash from original data that arrives in order, in
+// pieces of any size.
+class ContentHasher {
+public:
+    void Update(std::span<const std::byte> data) {
+        while (!data.empty()) {
+            const size_t take = std::min(kChunkSize - filled_, data.size());
+            piece_.Update(data.first(take));
+            data = data.subspan(take);
+            filled_ += take;
+            if (filled_ == kChunkSize) {
+                digests_.push_back(piece_.Digest());
+                piece_ = hammingcoder::XxHash64();
+                filled_ = 0;
+            }
+        }
     }
-    FileHeader header = DecodeHeader(reinterpret_cast<const char*>(&encoded_header));
-    
-    if (std::string(header.magic, 4) != "HAF\x01") {
+
+    unsigned long long Digest() const {
+        if (filled_ == 0) {
+            return CombineDigests(digests_);
+        }
+        std::vector<unsigned long long> digests = digests_;
+        digests.push_back(piece_.Digest());
+        return CombineDigests(digests);
+    }
+
+private:
+    hammingcoder::XxHash64 piece_;
+    size_t filled_ = 0;
+    std::vector<unsigned long long> digests_;
+};
+
+// Feeds everything read through it to a ContentHasher. Seeking is passed
+// on to the wrapped buffer so the encoder can size the input, and must
+// happen before the first read.
+class HashingStreambuf : public std::streambuf {
+public:
+    HashingStreambuf(std::streambuf* source, ContentHasher& hasher) : source_(source), hasher_(hasher) {}
+
+protected:
+    int_type underflow() override {
+        const std::streamsize got = source_->sgetn(buffer_, sizeof(buffer_));
+        if (got <= 0) {
+            return traits_type::eof();
+        }
+        hasher_.Update(std::as_bytes(std::span(buffer_, static_cast<size_t>(got))));
+        setg(buffer_, buffer_, buffer_ + got);
+        return traits_type::to_int_type(buffer_[0]);
+    }
+
+    pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override {
+        return source_->pubseekoff(off, dir, which);
+    }
+
+    pos_type seekpos(pos_type pos, std::ios_base::openmode which) override {
+        return source_->pubseekpos(pos, which);
+    }
+
+private:
+    std::streambuf* source_;
+    ContentHasher& hasher_;
+    char buffer_[64 * 1024];
+};
+
+#ifdef HAMARC_HAVE_ZLIB
+// Deflates `input` into one zlib stream and Hamming encodes it in whole
+// chunks of `options`, so the payload decodes like any other. Fills in the
+// sizes of `entry` and feeds the original data to `hasher`.
+bool EncodeDeflated(std::istream& input, const hammingcoder::StreamOptions& options, const ByteWriter& write,
+                    MemberEntry& entry, hammingcoder::ProgressMeter& meter, ContentHasher& hasher){
+    z_stream stream = {};
+    // The fastest level: archives are I/O-bound and most of the gain on text
+    // and logs is already there.
+    if (deflateInit(&stream, Z_BEST_SPEED) != Z_OK) {
         return false;
     }
 
-    state.files.clear();
-    for (unsigned int i = 0; i < header.fileCount; i++) {
-        EncodedFileEntry encoded_entry;
-        file.read(reinterpret_cast<char*>(&encoded_entry), sizeof(encoded_entry));
+    const size_t chunk_size = hammingcoder::AlignedBlockSize(options);
+    std::vector<char> raw(kChunkSize);
+    std::vector<std::byte> packed(chunk_size);
+    std::vector<std::byte> encoded(hammingcoder::EncodedStreamSize(chunk_size, options));
+    size_t filled = 0;
+    entry.originalSize = 0;
+    entry.encodedSize = 0;
+    auto flush = [&]() {
+        size_t size = hammingcoder::EncodeBlock(std::span(packed).first(filled), encoded, options);
+        entry.encodedSize += size;
+        filled = 0;
+        return write(encoded.data(), size);
+    };
+
+    bool ok = true;
+    int status = Z_OK;
+    while (ok && status != Z_STREAM_END) {
+        input.read(raw.data(), raw.size());
+        const size_t got = static_cast<size_t>(input.gcount());
+        if (input.bad()) {
+            ok = false;
+            break;
+        }
+        entry.originalSize += got;
+        hasher.Update(std::as_bytes(std::span(raw).first(got)));
+        meter.Advance(got);
+        stream.next_in = reinterpret_cast<Bytef*>(raw.data());
+        stream.avail_in = static_cast<uInt>(got);
+        const int mode = input ? Z_NO_FLUSH : Z_FINISH;
+        do {
+            stream.next_out = reinterpret_cast<Bytef*>(packed.data() + filled);
+            stream.avail_out = static_cast<uInt>(chunk_size - filled);
+            status = deflate(&stream, mode);
+            filled = chunk_size - stream.avail_out;
+            if (filled == chunk_size) {
+                ok = flush();
+            }
+        } while (ok && (stream.avail_in > 0 || stream.avail_out == 0));
+    }
+    deflateEnd(&stream);
+    return ok && (filled == 0 || flush());
+}
 
-        if (file.gcount() != sizeof(encoded_entry)) {
-            return false;
+// Inflates a deflated member's decoded payload as it arrives, in order.
+// Padding behind the end of the zlib stream is ignored.
+class Inflater {
+public:
+    Inflater() : out_(kChunkSize) {
+        ok_ = inflateInit(&stream_) == Z_OK;
+    }
+    ~Inflater() {
+        inflateEnd(&stream_);
+    }
+    Inflater(const Inflater&) = delete;
+    Inflater& operator=(const Inflater&) = delete;
+
+    bool Feed(const std::byte* data, size_t size, const ByteWriter& write) {
+        stream_.next_in = reinterpret_cast<Bytef*>(const_cast<std::byte*>(data));
+        stream_.avail_in = static_cast<uInt>(size);
+        while (ok_ && !ended_ && stream_.avail_in > 0) {
+            stream_.next_out = reinterpret_cast<Bytef*>(out_.data());
+            stream_.avail_out = static_cast<uInt>(out_.size());
+            int status = inflate(&stream_, Z_NO_FLUSH);
+            ended_ = status == Z_STREAM_END;
+            ok_ = (status == Z_OK || ended_) && write(out_.data(), out_.size() - stream_.avail_out);
         }
+        return ok_;
+    }
 
-        FileEntry entry = DecodeFileEntry(reinterpret_cast<const char*>(&encoded_entry));
-        state.files[entry.filename] = entry;
+    // True once the whole stream was inflated into `size` bytes.
+    bool Finished(unsigned long long size) const {
+        return ok_ && ended_ && stream_.total_out == size;
     }
-    
-    return true;
+
+private:
+    z_stream stream_ = {};
+    std::vector<std::byte> out_;
+    bool ok_ = false;
+    bool ended_ = false;
+};
+#else
+bool EncodeDeflated(std::istream&, const hammingcoder::StreamOptions&, const ByteWriter&, MemberEntry&,
+                    hammingcoder::ProgressMeter&, ContentHasher&){
+    return false;
+}
+
+class Inflater {
+public:
+    bool Feed(const std::byte*, size_t, const ByteWriter&) { return false; }
+    bool Finished(unsigned long long) const { return false; }
+};
+#endif
+
+// contentHash and size of a whole file, read in kChunkSize pieces.
+bool HashFile(const std::string& path, unsigned long long& hash, unsigned long long& size){
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+    ContentHasher hasher;
+    std::vector<char> chunk(kChunkSize);
+    size = 0;
+    while (file) {
+        file.read(chunk.data(), chunk.size());
+        size += static_cast<unsigned long long>(file.gcount());
+        hasher.Update(std::as_bytes(std::span(chunk).first(static_cast<size_t>(file.gcount()))));
+    }
+    hash = hasher.Digest();
+    return !file.bad();
 }
 
-bool AddFileToArchive(const std::string &filePath, std::ofstream &archive, ArchiveState &state, unsigned long long &currentOffset){
+// Encodes a file at `currentOffset` and hashes it as it is read.
+bool AddFileToArchive(const std::string &filePath, std::ostream &archive, ArchiveState &state, unsigned long long &currentOffset){
     std::ifstream file(filePath, std::ios::binary);
     if (!file) {
         std::cout << "Cannot open file: " << filePath << std::endl;
         return false;
     }
 
-    file.seekg(0, std::ios::end);
-    size_t file_size = file.tellg();
-    file.seekg(0, std::ios::beg);
+    archive.seekp(currentOffset);
+    std::string filename = GetFilename(filePath);
+    hammingcoder::StreamOptions options = PayloadOptions(state);
+    MemberEntry entry = {filename, 0, 0, currentOffset, 0, state.compression};
+    ContentHasher hasher;
+    if (state.compression != kCompressionNone) {
+        options.block_size = kChunkSize;
+        hammingcoder::ProgressMeter meter(ProgressFor(state, filename), 0);
+        bool ok = EncodeDeflated(file, options, [&archive](const std::byte* data, size_t size) {
+            archive.write(reinterpret_cast<const char*>(data), size);
+            return static_cast<bool>(archive);
+        }, entry, meter, hasher);
+        meter.Finish();
+        if (!ok) {
+            return false;
+        }
+    } else {
+        HashingStreambuf hashing(file.rdbuf(), hasher);
+        std::istream input(&hashing);
+        options.progress = ProgressFor(state, filename);
+        hammingcoder::EncodeStream(input, archive, [&](size_t done, size_t) { entry.originalSize = done; }, options);
+        entry.encodedSize = hammingcoder::EncodedStreamSize(entry.originalSize, options);
+        if (input.bad()) {
+            return false;
+        }
+    }
 
-    if (file_size == static_cast<size_t>(-1)) {
+    if (!archive || file.bad()) {
         return false;
     }
+    entry.contentHash = hasher.Digest();
 
-    std::vector<char> original_data(file_size);
-    file.read(original_data.data(), file_size);
-
-    std::vector<char> encoded_data = hammingcoder::EncodeData(original_data);
+    currentOffset += entry.encodedSize;
+    state.files.Insert(entry);
 
-    FileEntry entry = {};
-    std::string filename = GetFilename(filePath);
-    std::strncpy(entry.filename, filename.c_str(), sizeof(entry.filename) - 1);
-    entry.filename[sizeof(entry.filename) - 1] = '\0';
-    entry.originalSize = original_data.size();
-    entry.encodedSize = encoded_data.size();
-    entry.offset = currentOffset;
+    return true;
+}
 
-    archive.seekp(currentOffset);
-    archive.write(encoded_data.data(), encoded_data.size());
+bool IsCompressionAvailable(Compression compression){
+#ifdef HAMARC_HAVE_ZLIB
+    return compression == kCompressionNone || compression == kCompressionDeflate;
+#else
+    return compression == kCompressionNone;
+#endif
+}
 
-    if (!archive) {
+// Writes a complete new archive to `archive_path`; CreateArchive moves it
+// into place.
+bool WriteNewArchive(const std::string &archive_path, const std::vector<std::string> &file_paths,
+                     const CreateOptions& options){
+    ArchiveState state;
+    state.archivePath = archive_path;
+    state.codec = options.codec;
+    state.interleave = options.interleave;
+    state.compression = options.compression;
+    state.progress = options.progress;
+    if (!IsCompressionAvailable(options.compression)) {
+        std::cout << "This build of hamarc has no compression support" << std::endl;
         return false;
     }
 
-    currentOffset += encoded_data.size();
-    state.files[filename] = entry;
+    // Input sizes fix every payload's encoded size, so all offsets are known
+    // before encoding and members can be written concurrently. Only inputs
+    // whose size matches another input's can have the same contents; those
+    // are hashed first, and one whose hash matches an earlier input's shares
+    // that input's payload and is not encoded at all. Every other input is
+    // hashed piece by piece while it is encoded. Deflated sizes are only
+    // known afterwards, so deflated members are written one by one.
+    struct Input {
+        const std::string* path;
+        std::string name;
+        MemberEntry entry = {};
+        bool hashed = false;
+        const Input* shared = nullptr;
+        std::vector<unsigned long long> digests;
+        std::unique_ptr<hammingcoder::ProgressMeter> meter;
+        size_t pending = 0;
+    };
+    struct Task {
+        size_t input;
+        unsigned long long begin;
+        unsigned long long end;
+    };
+
+    hammingcoder::StreamOptions stream_options = PayloadOptions(state);
+    stream_options.block_size = kChunkSize;
+    const size_t chunk_size = hammingcoder::AlignedBlockSize(stream_options);
+    const size_t encoded_chunk_size = hammingcoder::EncodedStreamSize(chunk_size, stream_options);
+
+    const std::vector<char> encoded_header = EncodeArchiveHeader(options);
+    unsigned long long current_offset = encoded_header.size();
+    std::vector<Input> inputs(file_paths.size());
+    std::unordered_map<unsigned long long, size_t> sizes;
+    for (size_t i = 0; i < file_paths.size(); i++){
+        std::ifstream file(file_paths[i], std::ios::binary | std::ios::ate);
+        std::error_code error;
+        if (!file || std::filesystem::is_directory(file_paths[i], error)) {
+            std::cout << "Cannot open file: " << file_paths[i] << std::endl;
+            return false;
+        }
+        Input& input = inputs[i];
+        input.path = &file_paths[i];
+        input.name = GetFilename(file_paths[i]);
+        input.entry.name = input.name;
+        input.entry.originalSize = static_cast<unsigned long long>(file.tellg());
+        input.entry.encodedSize = hammingcoder::EncodedStreamSize(input.entry.originalSize, stream_options);
+        input.meter = std::make_unique<hammingcoder::ProgressMeter>(ProgressFor(state, input.name),
+                                                                    input.entry.originalSize);
+        sizes[input.entry.originalSize]++;
+    }
 
-    return true;
-}
+    std::vector<size_t> colliding;
+    for (size_t i = 0; i < inputs.size(); i++){
+        if (sizes[inputs[i].entry.originalSize] > 1) {
+            colliding.push_back(i);
+        }
+    }
+    std::atomic<bool> failed{false};
+    RunTasks(colliding.size(), options.threads, [&](size_t c) {
+        Input& input = inputs[colliding[c]];
+        unsigned long long size = 0;
+        if (!failed && (!HashFile(*input.path, input.entry.contentHash, size) || size != input.entry.originalSize)) {
+            std::cout << "File changed while archiving: " << *input.path << std::endl;
+            failed = true;
+        }
+        input.hashed = true;
+    });
+    if (failed) {
+        return false;
+    }
 
-bool CreateArchive(const std::string &archive_path, const std::vector<std::string> &file_paths){
-    std::ofstream archive(archive_path, std::ios::binary);
-    if (!archive) {
+    std::unordered_map<unsigned long long, const Input*> payloads;
+    std::vector<Task> tasks;
+    for (size_t i = 0; i < inputs.size(); i++){
+        Input& input = inputs[i];
+        if (input.hashed) {
+            auto [payload, inserted] = payloads.emplace(input.entry.contentHash, &input);
+            if (!inserted && payload->second->entry.originalSize == input.entry.originalSize) {
+                input.shared = payload->second;
+                input.meter->Advance(input.entry.originalSize);
+                input.meter->Finish();
+                continue;
+            }
+        }
+        if (options.compression != kCompressionNone) {
+            continue;
+        }
+        input.digests.resize(PieceCount(input.entry.originalSize));
+        input.entry.offset = current_offset;
+        current_offset += input.entry.encodedSize;
+
+        unsigned long long begin = 0;
+        do {
+            unsigned long long end = std::min(begin + kSplitChunks * chunk_size, input.entry.originalSize);
+            tasks.push_back({i, begin, end});
+            input.pending++;
+            begin = end;
+        } while (begin < input.entry.originalSize);
+    }
+
+    PositionalFile archive(archive_path, true);
+    if (!archive.IsOpen() || !archive.WriteAt(encoded_header.data(), encoded_header.size(), 0)) {
         return false;
     }
 
-    ArchiveState state;
-    state.archivePath = archive_path;
-    
-    FileHeader header = {};
-    std::vector<char> encoded_header = EncodeHeader(header);
-    archive.write(encoded_header.data(), encoded_header.size());
-    unsigned long long current_offset = encoded_header.size();
+    std::mutex progress_mutex;
+    RunTasks(tasks.size(), options.threads, [&](size_t t) {
+        const Task& task = tasks[t];
+        Input& input = inputs[task.input];
+        std::ifstream file(*input.path, std::ios::binary);
+        file.seekg(task.begin);
+        std::vector<char> chunk(chunk_size);
+        std::vector<std::byte> encoded_chunk(encoded_chunk_size);
+        unsigned long long encoded_offset = input.entry.offset + task.begin / chunk_size * encoded_chunk_size;
+        for (unsigned long long done = task.begin; !failed && done < task.end; done += chunk_size) {
+            size_t want = static_cast<size_t>(std::min<unsigned long long>(task.end - done, chunk_size));
+            file.read(chunk.data(), want);
+            if (file.gcount() != static_cast<std::streamsize>(want)) {
+                std::cout << "File changed while archiving: " << *input.path << std::endl;
+                failed = true;
+                break;
+            }
+            HashPieces(input.digests, reinterpret_cast<const std::byte*>(chunk.data()), want, done);
+            size_t encoded = hammingcoder::EncodeBlock(std::as_bytes(std::span(chunk).first(want)), encoded_chunk,
+                                                       stream_options);
+            if (!archive.WriteAt(encoded_chunk.data(), encoded, encoded_offset)) {
+                failed = true;
+                break;
+            }
+            encoded_offset += encoded;
+        }
 
-    for (const auto& file_path : file_paths){
-        FileEntry entry = {};
-        std::string filename = GetFilename(file_path);
-        std::strncpy(entry.filename, filename.c_str(), sizeof(entry.filename) - 1);
-        std::vector<char> encoded_entry = EncodeFileEntry(entry);
-        archive.write(encoded_entry.data(), encoded_entry.size());
-        current_offset += encoded_entry.size();
+        std::lock_guard<std::mutex> lock(progress_mutex);
+        input.meter->Advance(task.end - task.begin);
+        if (--input.pending == 0){
+            input.meter->Finish();
+        }
+    });
+    if (failed) {
+        return false;
     }
 
-    for (const auto& file_path : file_paths){
-        if (!AddFileToArchive(file_path, archive, state, current_offset)){
+    for (Input& input : inputs){
+        if (options.compression != kCompressionNone || input.shared) {
+            continue;
+        }
+        const unsigned long long hash = CombineDigests(input.digests);
+        if (input.hashed && hash != input.entry.contentHash) {
+            std::cout << "File changed while archiving: " << *input.path << std::endl;
             return false;
         }
+        input.entry.contentHash = hash;
     }
 
-    header.fileCount = state.files.size();
-    header.totalSize = current_offset;
-    std::vector<char> updated_header = EncodeHeader(header);
-    archive.seekp(0);
-    archive.write(updated_header.data(), updated_header.size());
+    for (Input& input : inputs){
+        if (options.compression == kCompressionNone || input.shared) {
+            continue;
+        }
+        std::ifstream file(*input.path, std::ios::binary);
+        const unsigned long long size = input.entry.originalSize;
+        input.entry.offset = current_offset;
+        input.entry.compression = options.compression;
+        unsigned long long written = current_offset;
+        ContentHasher hasher;
+        bool ok = EncodeDeflated(file, stream_options, [&](const std::byte* data, size_t encoded) {
+            written += encoded;
+            return archive.WriteAt(data, encoded, written - encoded);
+        }, input.entry, *input.meter, hasher);
+        input.meter->Finish();
+        const unsigned long long hash = hasher.Digest();
+        if (!ok || input.entry.originalSize != size || (input.hashed && hash != input.entry.contentHash)) {
+            std::cout << "File changed while archiving: " << *input.path << std::endl;
+            return false;
+        }
+        input.entry.contentHash = hash;
+        current_offset += input.entry.encodedSize;
+    }
 
-    archive.seekp(encoded_header.size());
-    for (const auto& [filename, entry] : state.files){
-        std::vector<char> encoded_entry = EncodeFileEntry(entry);
-        archive.write(encoded_entry.data(), encoded_entry.size());
+    std::vector<MemberRecord> records;
+    for (Input& input : inputs){
+        if (input.shared) {
+            input.entry.offset = input.shared->entry.offset;
+            input.entry.encodedSize = input.shared->entry.encodedSize;
+            input.entry.compression = input.shared->entry.compression;
+        }
+        records.push_back(MakeRecord(input.entry, kRecordAdd));
     }
+    std::vector<char> encoded_index = EncodeIndex(SnapshotRecords(records), 0, current_offset, kIndexSnapshot);
+    return archive.WriteAt(encoded_index.data(), encoded_index.size(), current_offset);
+}
 
+bool CreateArchive(const std::string &archive_path, const std::vector<std::string> &file_paths,
+                   const CreateOptions& options){
+    // An existing archive stays untouched until the new one is complete.
+    std::string temp_path = archive_path + ".tmp";
+    if (!WriteNewArchive(temp_path, file_paths, options) || !RenameFile(temp_path, archive_path)) {
+        std::remove(temp_path.c_str());
+        return false;
+    }
     return true;
 }
 
 bool LoadArchive(ArchiveState &state){
-    std::ifstream archive(state.archivePath, std::ios::binary);
-    if (!archive){
+    ArchiveReader reader(state.archivePath);
+    if (!reader.IsOpen()){
+        return false;
+    }
+
+    return ValidateArchive(reader, state);
+}
+
+bool OpenArchive(ArchiveState &state){
+    ArchiveReader reader(state.archivePath);
+    if (!reader.IsOpen()){
         return false;
     }
 
-    return ValidateArchive(archive, state);
+    return ParseDirectory([&](unsigned long long offset, size_t size) { return MappedBytes(reader, offset, size); },
+                          reader.Size(), state, false);
 }
 
 std::vector<std::string> ListFiles(const ArchiveState &state){
     std::vector<std::string> files;
-    for (const auto& [filename, entry] : state.files){
-        files.push_back(filename);
+    for (const MemberEntry* entry : state.files.SortedByName()){
+        files.emplace_back(entry->name);
     }
     return files;
 }
 
 bool ExtractFile(const ArchiveState &state, const std::string &filename, const std::string& output){
-    auto it = state.files.find(filename);
-    if (it == state.files.end()){
+    ArchiveReader reader(state.archivePath);
+    if (!reader.IsOpen()){
         return false;
     }
+    return ExtractFile(state, reader, filename, output);
+}
+
+hammingcoder::StreamOptions ExtractOptions(const ArchiveState& state){
+    hammingcoder::StreamOptions options = PayloadOptions(state);
+    options.block_size = kChunkSize;
+    return options;
+}
+
+using DecodedSink = std::function<bool(const std::byte* data, size_t size, unsigned long long member_offset)>;
 
-    std::ifstream archive(state.archivePath, std::ios::binary);
-    if(!archive){
+// The smallest run of data bytes that encodes on its own: one byte, one
+// SECDED word or one interleave group.
+size_t UnitSize(hammingcoder::StreamOptions options){
+    options.block_size = 1;
+    return hammingcoder::AlignedBlockSize(options);
+}
+
+// Decodes payload bytes [begin, end) of a member, which must start on a
+// codeword boundary (an interleave group boundary when interleaved), and
+// hands the decoded bytes to `sink`.
+// A deflated member's zlib stream is passed on padding and all.
+// Stops at the first chunk with an uncorrectable codeword.
+bool DecodeMemberRange(const ArchiveReader& reader, const MemberEntry& entry, const hammingcoder::StreamOptions& options,
+                       unsigned long long begin, unsigned long long end, const DecodedSink& sink,
+                       hammingcoder::DecodeReport& report, hammingcoder::ProgressMeter* meter){
+    std::span<const std::byte> payload = reader.Range(entry.offset, entry.encodedSize);
+    if (payload.size() != entry.encodedSize){
         return false;
     }
 
-    const FileEntry& entry = it -> second;
-    
-    archive.seekg(entry.offset);
-    std::vector<char> encoded_data(entry.encodedSize);
-    archive.read(encoded_data.data(), entry.encodedSize);
-    
-    if (archive.gcount() != static_cast<std::streamsize>(entry.encodedSize)) {
+    const size_t chunk_size = hammingcoder::AlignedBlockSize(options);
+    const size_t encoded_chunk_size = hammingcoder::EncodedStreamSize(chunk_size, options);
+    const hammingcoder::Codec& codec = hammingcoder::GetCodec(options.codec);
+    // Deinterleaving works in place, so only interleaved payloads are copied
+    // out of the mapping; plain ones are decoded straight from it.
+    std::vector<std::byte> scratch(options.interleave != 0 ? encoded_chunk_size : 0);
+    std::vector<std::byte> decoded_chunk(chunk_size);
+    const size_t unit = UnitSize(options);
+    unsigned long long member_offset = begin / hammingcoder::EncodedStreamSize(unit, options) * unit;
+    const unsigned long long limit = entry.compression == kCompressionNone ? entry.originalSize
+                                                                           : std::numeric_limits<unsigned long long>::max();
+
+    reader.WillRead(entry.offset + begin, end - begin);
+    for (unsigned long long done = begin; done < end; done += encoded_chunk_size) {
+        std::span<const std::byte> chunk = payload.subspan(done, std::min<unsigned long long>(end - done,
+                                                                                               encoded_chunk_size));
+        hammingcoder::DecodeReport chunk_report;
+        size_t decoded;
+        if (scratch.empty()) {
+            decoded = codec.DecodeInto(chunk, decoded_chunk, chunk_report, entry.offset + done);
+        } else {
+            std::copy(chunk.begin(), chunk.end(), scratch.begin());
+            decoded = hammingcoder::DecodeBlock(std::span(scratch).first(chunk.size()), decoded_chunk,
+                                                chunk_report, entry.offset + done, options);
+        }
+        if (meter) {
+            meter->Advance(chunk.size(), chunk_report.corrected, chunk_report.uncorrectable);
+        }
+        report.Merge(chunk_report);
+        if (chunk_report.uncorrectable > 0) {
+            return false;
+        }
+
+        if (member_offset < limit) {
+            decoded = static_cast<size_t>(std::min<unsigned long long>(decoded, limit - member_offset));
+            if (!sink(decoded_chunk.data(), decoded, member_offset)) {
+                return false;
+            }
+        }
+        member_offset += decoded;
+    }
+    return true;
+}
+
+void ReportDamagedMember(const std::string& filename, const hammingcoder::DecodeReport& report){
+    std::cout << "ФАЙЛ УВЫ ПОВРЕЖДЕН ПЛАКИ ПЛАКИ :((()))" << std::endl;
+    PrintDamage(filename, report);
+}
+
+bool ExtractFile(const ArchiveState &state, const ArchiveReader &reader, const std::string &filename,
+                 const std::string& output){
+    MemberEntry entry;
+    if (!FindMember(state, reader, filename, entry)){
+        return false;
+    }
+    if (!IsCompressionAvailable(entry.compression)){
+        std::cout << "Cannot unpack " << filename << ": unsupported compression" << std::endl;
         return false;
     }
 
@@ -232,146 +1616,589 @@ bool ExtractFile(const ArchiveState &state, const std::string &filename, const s
         return false;
     }
 
-    int correct, uncorrect;
-    std::vector<char> decoded_data = hammingcoder::DecodeData(encoded_data, correct, uncorrect);
-
-    if (uncorrect > 0 ){
-        std::cout << "ФАЙЛ УВЫ ПОВРЕЖДЕН ПЛАКИ ПЛАКИ :((()))";
+    ByteWriter write = [&output_file](const std::byte* data, size_t size) {
+        output_file.write(reinterpret_cast<const char*>(data), size);
+        return static_cast<bool>(output_file);
+    };
+    Inflater inflater;
+    hammingcoder::DecodeReport report;
+    hammingcoder::ProgressMeter meter(ProgressFor(state, filename), entry.encodedSize);
+    bool ok = DecodeMemberRange(reader, entry, ExtractOptions(state), 0, entry.encodedSize,
+        [&](const std::byte* data, size_t size, unsigned long long) {
+            return entry.compression == kCompressionNone ? write(data, size) : inflater.Feed(data, size, write);
+        }, report, &meter);
+    ok = ok && (entry.compression == kCompressionNone || inflater.Finished(entry.originalSize));
+    meter.Finish();
+    output_file.close();
+
+    if (report.uncorrectable > 0 ){
+        ReportDamagedMember(filename, report);
+    }
+    if (!ok || !output_file){
+        std::remove(out_file.c_str());
         return false;
     }
 
-    output_file.write(decoded_data.data(), decoded_data.size());
-    
     return true;
 }
 
-bool ExtractAll(const ArchiveState &state, const std::string &output_dir){
+bool ExtractRange(const ArchiveState &state, const std::string &filename, unsigned long long start,
+                  unsigned long long end, const std::string& output){
+    ArchiveReader reader(state.archivePath);
+    MemberEntry entry;
+    if (!reader.IsOpen() || !FindMember(state, reader, filename, entry)){
+        return false;
+    }
+    if (!IsCompressionAvailable(entry.compression)){
+        std::cout << "Cannot unpack " << filename << ": unsupported compression" << std::endl;
+        return false;
+    }
+    end = std::min(end, entry.originalSize);
+    start = std::min(start, end);
 
-    if (!output_dir.empty() && !FileExist(output_dir)){
-        if (!MakeDirectory(output_dir)){
-            return false;
+    std::ofstream output_file(output, std::ios::binary);
+    if (!output_file){
+        return false;
+    }
+
+    // Keeps the part of the decoded bytes at member `offset` that falls in
+    // the range, and stops the decoding once the range is complete.
+    bool complete = start == end;
+    auto clip = [&](const std::byte* data, size_t size, unsigned long long offset) {
+        unsigned long long from = std::max(offset, start);
+        unsigned long long to = std::min(offset + size, end);
+        if (from < to){
+            output_file.write(reinterpret_cast<const char*>(data + (from - offset)), to - from);
         }
+        complete = offset + size >= end;
+        return output_file && !complete;
+    };
+
+    const hammingcoder::StreamOptions options = ExtractOptions(state);
+    hammingcoder::DecodeReport report;
+    bool ok = true;
+    if (complete){
+        // Nothing to decode.
+    } else if (entry.compression == kCompressionNone){
+        const size_t unit = UnitSize(options);
+        const unsigned long long encoded_unit = hammingcoder::EncodedStreamSize(unit, options);
+        const unsigned long long begin = start / unit * encoded_unit;
+        const unsigned long long stop = std::min(entry.encodedSize, (end + unit - 1) / unit * encoded_unit);
+        ok = DecodeMemberRange(reader, entry, options, begin, stop, clip, report, nullptr);
+    } else {
+        // A zlib stream has no random access: inflate from the start, but
+        // read no further than the range needs.
+        Inflater inflater;
+        unsigned long long inflated = 0;
+        ByteWriter write = [&](const std::byte* data, size_t size) {
+            inflated += size;
+            return clip(data, size, inflated - size);
+        };
+        ok = DecodeMemberRange(reader, entry, options, 0, entry.encodedSize,
+            [&](const std::byte* data, size_t size, unsigned long long) { return inflater.Feed(data, size, write); },
+            report, nullptr);
+    }
+    output_file.close();
+
+    if (report.uncorrectable > 0){
+        ReportDamagedMember(filename, report);
+    }
+    if (!(ok || complete) || !output_file){
+        std::remove(output.c_str());
+        return false;
     }
+    return true;
+}
 
-    for (const auto& [filename, entry] : state.files){
-        std::string output_path = output_dir.empty() ? filename : (output_dir + "/" + filename);
-        if (!ExtractFile(state, filename, output_path)){
+bool ScrubRegion(PositionalFile& archive, unsigned long long offset, unsigned long long size,
+                 const hammingcoder::StreamOptions& options, const hammingcoder::ProgressCallback& progress,
+                 ScrubReport& report){
+    hammingcoder::StreamOptions chunk_options = options;
+    chunk_options.block_size = kChunkSize;
+    std::vector<std::byte> chunk(hammingcoder::EncodedStreamSize(hammingcoder::AlignedBlockSize(chunk_options),
+                                                                 chunk_options));
+    hammingcoder::ProgressMeter meter(progress, size);
+
+    while (size > 0) {
+        size_t want = static_cast<size_t>(std::min<unsigned long long>(size, chunk.size()));
+        if (!archive.ReadAt(chunk.data(), want, offset)) {
             return false;
         }
+
+        hammingcoder::DecodeReport chunk_report;
+        std::vector<hammingcoder::DamagedRange> repaired;
+        size_t rewritten = hammingcoder::RepairBlock(std::span(chunk).first(want), chunk_report, repaired,
+                                                     offset, options);
+        for (const auto& range : repaired) {
+            if (!archive.WriteAt(chunk.data() + (range.offset - offset), range.length, range.offset)) {
+                return false;
+            }
+        }
+        report.repaired.insert(report.repaired.end(), repaired.begin(), repaired.end());
+        meter.Advance(want, chunk_report.corrected, chunk_report.uncorrectable);
+        report.decode.Merge(chunk_report);
+        report.scanned += want;
+        report.rewritten += rewritten;
+        offset += want;
+        size -= want;
     }
+    meter.Finish();
     return true;
 }
 
-bool AppendFile(ArchiveState &state, const std::string &filePath){
-    std::fstream archive(state.archivePath, std::ios::binary | std::ios::in | std::ios::out);
-    if (!archive){
+bool ScrubArchive(const ArchiveState &state, ScrubReport &report){
+    PositionalFile archive(state.archivePath);
+    if (!archive.IsOpen()){
         return false;
     }
-    
-    if (!LoadArchive(state)) {
-        return false;
+
+    for (const ArchiveRange& range : state.metadata){
+        if (!ScrubRegion(archive, range.offset, range.size, {}, nullptr, report)){
+            return false;
+        }
     }
 
-    FileHeader header;
-    archive.read(reinterpret_cast<char*>(&header), sizeof(header));
-    if (!archive) {
-        return false;
+    std::vector<const MemberEntry*> entries;
+    for (const MemberEntry& entry : state.files){
+        entries.push_back(&entry);
+    }
+    std::sort(entries.begin(), entries.end(),
+              [](const MemberEntry* a, const MemberEntry* b) { return ByPayload(*a, *b); });
+
+    hammingcoder::StreamOptions options = PayloadOptions(state);
+    for (size_t i = 0; i < entries.size(); i++){
+        const MemberEntry* entry = entries[i];
+        if (i > 0 && SharesPayload(*entries[i - 1], *entry)){
+            continue;   // a deduplicated payload, already scrubbed
+        }
+        if (!ScrubRegion(archive, entry->offset, entry->encodedSize, options,
+                         ProgressFor(state, std::string(entry->name)), report)){
+            return false;
+        }
     }
 
-    archive.seekp(0, std::ios::end);
-    unsigned long long current_offset = archive.tellp();
+    return report.rewritten == 0 || archive.Sync();
+}
 
-    std::ifstream file(filePath, std::ios::binary);
-    if(!file){
-        return false;
+void PrintScrubReport(const ScrubReport& report){
+    std::cout << "scanned " << report.scanned << " bytes, corrected " << report.decode.corrected
+              << " codewords, rewrote " << report.rewritten << " bytes in " << report.repaired.size()
+              << " ranges" << std::endl;
+    if (report.decode.uncorrectable > 0){
+        PrintDamage("archive", report.decode);
     }
+}
 
-    file.seekg(0, std::ios::end);
-    size_t file_size = file.tellg();
-    file.seekg(0, std::ios::beg);
+bool ExtractAll(const ArchiveState &state, const std::string &output_dir, unsigned threads){
+
+    if (!output_dir.empty() && !FileExist(output_dir)){
+        if (!MakeDirectory(output_dir)){
+            return false;
+        }
+    }
 
-    if (file_size == static_cast<size_t>(-1)) {
+    ArchiveReader reader(state.archivePath);
+    if (!reader.IsOpen()){
         return false;
     }
 
-    std::vector<char> file_data;
-    const size_t chunk_size = 64 * 1024; 
-    std::vector<char> chunk(chunk_size);
-    
-    while (file.read(chunk.data(), chunk_size) || file.gcount() > 0) {
-        size_t bytes_read = file.gcount();
-        file_data.insert(file_data.end(), chunk.begin(), chunk.begin() + bytes_read);
+    // An output file is created by the first task of its member and closed
+    // when the member's last task finishes. Tasks are claimed in order, so
+    // at most one member per worker plus the one being claimed is open at a
+    // time, however many members the archive has.
+    struct Member {
+        std::string filename;
+        const MemberEntry* entry;
+        std::once_flag open_once;
+        std::unique_ptr<PositionalFile> output;
+        std::string output_path;
+        std::unique_ptr<hammingcoder::ProgressMeter> meter;
+        size_t pending = 0;
+        bool created = false;
+        std::atomic<bool> failed{false};
+    };
+    struct Task {
+        size_t member;
+        unsigned long long begin;
+        unsigned long long end;
+        hammingcoder::DecodeReport report;
+    };
+
+    const hammingcoder::StreamOptions options = ExtractOptions(state);
+    const unsigned long long split = kSplitChunks * hammingcoder::EncodedStreamSize(
+        hammingcoder::AlignedBlockSize(options), options);
+    std::vector<Member> members(state.files.Size());
+    std::vector<Task> tasks;
+    size_t index = 0;
+    for (const MemberEntry& entry : state.files){
+        Member& member = members[index];
+        member.filename = std::string(entry.name);
+        const std::string& filename = member.filename;
+        member.entry = &entry;
+        member.output_path = output_dir.empty() ? filename : (output_dir + "/" + filename);
+        member.meter = std::make_unique<hammingcoder::ProgressMeter>(ProgressFor(state, filename), entry.encodedSize);
+        if (!IsCompressionAvailable(entry.compression)){
+            member.failed = true;
+        }
+        // A zlib stream inflates front to back, so deflated members are one task.
+        const unsigned long long piece = entry.compression == kCompressionNone ? split : entry.encodedSize;
+        unsigned long long begin = 0;
+        do {
+            unsigned long long end = std::min(begin + piece, entry.encodedSize);
+            tasks.push_back({index, begin, end, {}});
+            member.pending++;
+            begin = end;
+        } while (begin < entry.encodedSize);
+        index++;
+    }
+
+    // Tasks keep their own reports and are merged in task order, so the
+    // counts and damaged ranges do not depend on thread scheduling.
+    std::mutex progress_mutex;
+    RunTasks(tasks.size(), threads, [&](size_t t) {
+        Task& task = tasks[t];
+        Member& member = members[task.member];
+        std::call_once(member.open_once, [&member]() {
+            if (member.failed){
+                return;
+            }
+            member.output = std::make_unique<PositionalFile>(member.output_path, true);
+            member.created = member.output->IsOpen();
+            if (!member.created){
+                member.failed = true;
+            }
+        });
+        if (!member.failed){
+            const MemberEntry& entry = *member.entry;
+            Inflater inflater;
+            unsigned long long inflated = 0;
+            ByteWriter write = [&](const std::byte* data, size_t size) {
+                inflated += size;
+                return member.output->WriteAt(data, size, inflated - size);
+            };
+            bool ok = DecodeMemberRange(reader, entry, options, task.begin, task.end,
+                [&](const std::byte* data, size_t size, unsigned long long offset) {
+                    return entry.compression == kCompressionNone ? member.output->WriteAt(data, size, offset)
+                                                                 : inflater.Feed(data, size, write);
+                }, task.report, nullptr);
+            ok = ok && (entry.compression == kCompressionNone || inflater.Finished(entry.originalSize));
+            if (!ok){
+                member.failed = true;
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(progress_mutex);
+        member.meter->Advance(task.end - task.begin, task.report.corrected, task.report.uncorrectable);
+        if (--member.pending == 0){
+            member.output.reset();
+            member.meter->Finish();
+        }
+    });
+
+    std::vector<hammingcoder::DecodeReport> reports(members.size());
+    for (const Task& task : tasks){
+        reports[task.member].Merge(task.report);
     }
+    size_t failed = 0;
+    for (size_t i = 0; i < members.size(); i++){
+        Member& member = members[i];
+        if (reports[i].uncorrectable > 0){
+            ReportDamagedMember(member.filename, reports[i]);
+        }
+        if (member.failed){
+            if (member.created){
+                std::remove(member.output_path.c_str());
+            }
+            failed++;
+        }
+    }
+    if (failed > 0){
+        std::cout << failed << " of " << members.size() << " files could not be extracted" << std::endl;
+    }
+    return failed == 0;
+}
 
-    if (file_data.size() != file_size) {
+bool VerifyArchive(const ArchiveState &state, VerifyReport &report, unsigned threads){
+    ArchiveReader reader(state.archivePath);
+    if (!reader.IsOpen()){
         return false;
     }
 
-    std::vector<char> encoded_data = hammingcoder::EncodeData(file_data);
+    // Pieces of a payload are decoded in parallel and each worker hashes
+    // the kChunkSize pieces of original data it decodes; the digests are
+    // combined once the payload is done. A deflated payload is one task,
+    // hashed as it is inflated.
+    struct Payload {
+        const MemberEntry* entry;
+        std::vector<std::string> names;
+        std::vector<unsigned long long> digests;
+        unsigned long long hash = 0;
+        std::unique_ptr<hammingcoder::ProgressMeter> meter;
+        size_t pending = 0;
+        std::atomic<bool> failed{false};
+    };
+    struct Task {
+        size_t payload;
+        unsigned long long begin;
+        unsigned long long end;
+        hammingcoder::DecodeReport report;
+    };
+
+    std::vector<const MemberEntry*> entries;
+    for (const MemberEntry& entry : state.files){
+        entries.push_back(&entry);
+    }
+    std::sort(entries.begin(), entries.end(), [](const MemberEntry* a, const MemberEntry* b) {
+        return SharesPayload(*a, *b) ? a->name < b->name : ByPayload(*a, *b);
+    });
+
+    const hammingcoder::StreamOptions options = ExtractOptions(state);
+    const unsigned long long split = kVerifyChunks * hammingcoder::EncodedStreamSize(
+        hammingcoder::AlignedBlockSize(options), options);
+    std::vector<std::unique_ptr<Payload>> payloads;
+    std::vector<Task> tasks;
+    for (const MemberEntry* entry : entries){
+        if (!payloads.empty() && SharesPayload(*payloads.back()->entry, *entry) &&
+            payloads.back()->entry->contentHash == entry->contentHash){
+            payloads.back()->names.emplace_back(entry->name);
+            continue;
+        }
+        auto payload = std::make_unique<Payload>();
+        payload->entry = entry;
+        payload->names.emplace_back(entry->name);
+        payload->digests.resize(PieceCount(entry->originalSize));
+        payload->meter = std::make_unique<hammingcoder::ProgressMeter>(ProgressFor(state, payload->names[0]),
+                                                                       entry->encodedSize);
+        if (!IsCompressionAvailable(entry->compression)){
+            payload->failed = true;
+        }
+        const unsigned long long piece = entry->compression == kCompressionNone ? split : entry->encodedSize;
+        unsigned long long begin = 0;
+        do {
+            unsigned long long end = std::min(begin + piece, entry->encodedSize);
+            tasks.push_back({payloads.size(), begin, end, {}});
+            payload->pending++;
+            begin = end;
+        } while (begin < entry->encodedSize);
+        payloads.push_back(std::move(payload));
+    }
+
+    std::mutex progress_mutex;
+    RunTasks(tasks.size(), threads, [&](size_t t) {
+        Task& task = tasks[t];
+        Payload& payload = *payloads[task.payload];
+        const MemberEntry& entry = *payload.entry;
+        if (!payload.failed && entry.compression != kCompressionNone){
+            Inflater inflater;
+            ContentHasher hasher;
+            ByteWriter hash = [&hasher](const std::byte* data, size_t size) {
+                hasher.Update(std::span(data, size));
+                return true;
+            };
+            bool ok = DecodeMemberRange(reader, entry, options, task.begin, task.end,
+                [&](const std::byte* data, size_t size, unsigned long long) { return inflater.Feed(data, size, hash); },
+                task.report, nullptr);
+            if (!ok || !inflater.Finished(entry.originalSize)){
+                payload.failed = true;
+            }
+            payload.hash = hasher.Digest();
+        } else if (!payload.failed){
+            // Decoded chunks are kChunkSize pieces of the member.
+            bool ok = DecodeMemberRange(reader, entry, options, task.begin, task.end,
+                [&payload](const std::byte* data, size_t size, unsigned long long member_offset) {
+                    HashPieces(payload.digests, data, size, member_offset);
+                    return true;
+                }, task.report, nullptr);
+            if (!ok){
+                payload.failed = true;
+            }
+        }
 
-    FileEntry new_entry = {};
-    std::string filename = GetFilename(filePath);
-    std::strncpy(new_entry.filename, filename.c_str(), sizeof(new_entry.filename) - 1);
-    new_entry.filename[sizeof(new_entry.filename) - 1] = '\0';
-    new_entry.originalSize = file_data.size();
-    new_entry.encodedSize = encoded_data.size();
-    new_entry.offset = current_offset;
+        std::lock_guard<std::mutex> lock(progress_mutex);
+        payload.meter->Advance(task.end - task.begin, task.report.corrected, task.report.uncorrectable);
+        if (--payload.pending == 0){
+            payload.meter->Finish();
+        }
+    });
 
-    archive.write(encoded_data.data(), encoded_data.size());
-    if (!archive) {
-        return false;
+    std::vector<hammingcoder::DecodeReport> reports(payloads.size());
+    for (const Task& task : tasks){
+        reports[task.payload].Merge(task.report);
+    }
+    for (size_t i = 0; i < payloads.size(); i++){
+        Payload& payload = *payloads[i];
+        report.members += payload.names.size();
+        report.decode.Merge(reports[i]);
+        if (reports[i].uncorrectable > 0){
+            ReportDamagedMember(payload.names[0], reports[i]);
+        }
+        bool ok = !payload.failed;
+        if (ok && payload.entry->compression == kCompressionNone){
+            payload.hash = CombineDigests(payload.digests);
+        }
+        if (ok && payload.entry->contentHash == 0){
+            report.unchecked += payload.names.size();
+        } else if (ok && payload.hash != payload.entry->contentHash){
+            std::cout << "Checksum mismatch: " << payload.names[0] << std::endl;
+            ok = false;
+        }
+        if (!ok){
+            report.failed.insert(report.failed.end(), payload.names.begin(), payload.names.end());
+        }
     }
+    return true;
+}
 
-    state.files[filename] = new_entry;
-    header.fileCount = state.files.size();
-    header.totalSize = current_offset + encoded_data.size();
+void PrintVerifyReport(const VerifyReport& report){
+    std::cout << "verified " << report.members - report.unchecked - report.failed.size() << " of "
+              << report.members << " members";
+    if (report.unchecked > 0){
+        std::cout << ", " << report.unchecked << " without a checksum";
+    }
+    std::cout << ", " << report.failed.size() << " failed" << std::endl;
+    for (const std::string& name : report.failed){
+        std::cout << "  " << name << std::endl;
+    }
+}
 
-    archive.seekp(0);
-    archive.write(reinterpret_cast<const char*>(&header), sizeof(header));
-    if (!archive) {
+struct MemberSource {
+    PositionalFile* file;
+    MemberEntry entry;
+};
+
+// Writes a kFormatLog archive holding `members`, whose payloads are copied
+// as they are; they must already be encoded the way `options` describes.
+// Members are expected in payload order, as MembersByOffset() gives them.
+bool WriteCopiedArchive(const std::string& path, const CreateOptions& options, const std::vector<MemberSource>& members){
+    PositionalFile archive(path, true);
+    if (!archive.IsOpen()) {
         return false;
     }
 
-    archive.seekp(sizeof(FileHeader));
-    for (const auto& [name, file_entry] : state.files){
-        archive.write(reinterpret_cast<const char*>(&file_entry), sizeof(file_entry));
-        if (!archive) {
-            return false;
+    std::vector<char> encoded_header = EncodeArchiveHeader(options);
+    bool ok = archive.WriteAt(encoded_header.data(), encoded_header.size(), 0);
+    unsigned long long current_offset = encoded_header.size();
+    std::vector<MemberRecord> records;
+    const MemberSource* previous = nullptr;
+    for (const MemberSource& member : members) {
+        MemberEntry entry = member.entry;
+        // Members sharing a payload are adjacent, and keep sharing its copy.
+        if (previous && previous->file == member.file && SharesPayload(previous->entry, entry)) {
+            entry.offset = records.back().offset;
+        } else {
+            ok = ok && member.file->CopyTo(archive, entry.offset, entry.encodedSize, current_offset);
+            entry.offset = current_offset;
+            current_offset += entry.encodedSize;
         }
+        records.push_back(MakeRecord(entry, kRecordAdd));
+        previous = &member;
     }
+    std::vector<char> encoded_index = EncodeIndex(SnapshotRecords(records), 0, current_offset, kIndexSnapshot);
+    return ok && archive.WriteAt(encoded_index.data(), encoded_index.size(), current_offset) && archive.Sync();
+}
 
-    return true;
+std::vector<MemberSource> MembersByOffset(PositionalFile& file, const ArchiveState& state){
+    std::vector<MemberSource> members;
+    for (const MemberEntry& entry : state.files) {
+        members.push_back({&file, entry});
+    }
+    std::sort(members.begin(), members.end(),
+              [](const MemberSource& a, const MemberSource& b) { return ByPayload(a.entry, b.entry); });
+    return members;
 }
 
-bool KillFile(ArchiveState &state, const std::string &filename){
-    auto it = state.files.find(filename);
-    if (it == state.files.end()){
+bool CompactArchive(ArchiveState &state){
+    PositionalFile source(state.archivePath);
+    if (!source.IsOpen()) {
         return false;
     }
 
-    state.files.erase(it);
+    std::string temp_path = state.archivePath + ".tmp";
+    if (!WriteCopiedArchive(temp_path, OptionsOf(state), MembersByOffset(source, state)) ||
+        !RenameFile(temp_path, state.archivePath)) {
+        std::remove(temp_path.c_str());
+        return false;
+    }
+    return LoadArchive(state);
+}
 
-    std::vector<std::string> temp;
-    for (const auto& [name, entry] : state.files){
-        temp.push_back(name);
+bool AppendFile(ArchiveState &state, const std::string &filePath){
+    if (!LoadArchive(state)) {
+        return false;
     }
-    std::string temp_path = state.archivePath + ".tmp";
-    if (!CreateArchive(temp_path, temp)){
+    if (state.format != kFormatLog && !CompactArchive(state)) {
         return false;
     }
-    if(!RenameFile(temp_path, state.archivePath)){
+
+    std::ifstream input(filePath, std::ios::binary | std::ios::ate);
+    if (!input) {
+        std::cout << "Cannot open file: " << filePath << std::endl;
         return false;
     }
+    const unsigned long long size = static_cast<unsigned long long>(input.tellg());
+    input.close();
+    // A member with the same contents already has an encoded payload to
+    // share. Only a member of the same size can, so the file is read ahead
+    // of encoding only when there is one.
+    const bool candidate = std::any_of(state.files.begin(), state.files.end(), [size](const MemberEntry& entry) {
+        return entry.originalSize == size && entry.contentHash != 0;
+    });
+    unsigned long long content_hash = 0, hashed_size = 0;
+    if (candidate && HashFile(filePath, content_hash, hashed_size) && hashed_size == size) {
+        for (const MemberEntry& entry : state.files) {
+            if (entry.contentHash == content_hash && entry.originalSize == size) {
+                MemberEntry shared = entry;
+                const std::string filename = GetFilename(filePath);
+                shared.name = filename;
+                return AppendIndex(state, {MakeRecord(shared, kRecordAdd)});
+            }
+        }
+    }
 
-    ArchiveState new_state;
-    new_state.archivePath = state.archivePath;
-    if(!LoadArchive(new_state)){
+    std::fstream archive(state.archivePath, std::ios::binary | std::ios::in | std::ios::out);
+    if (!archive) {
+        return false;
+    }
+    archive.seekp(0, std::ios::end);
+    unsigned long long current_offset = static_cast<unsigned long long>(archive.tellp());
+    const unsigned long long original_size = current_offset;
+
+    // Until the new index block is written, the payload is only trailing
+    // bytes behind the old footer; on failure they are cut off again.
+    ArchiveState added = state;
+    added.files.Clear();
+    bool ok = AddFileToArchive(filePath, archive, added, current_offset);
+    archive.close();
+    std::vector<MemberRecord> records;
+    for (const MemberEntry& entry : added.files) {
+        records.push_back(MakeRecord(entry, kRecordAdd));
+    }
+    if (!ok || !archive || !AppendIndex(state, records)) {
+        PositionalFile truncated(state.archivePath);
+        if (truncated.IsOpen()) {
+            truncated.Truncate(original_size);
+        }
         return false;
     }
-    state.files = new_state.files;
     return true;
 }
 
+bool KillFile(ArchiveState &state, const std::string &filename){
+    if (!LoadArchive(state)) {
+        return false;
+    }
+    if (!state.files.Find(filename)){
+        return false;
+    }
+    if (state.format != kFormatLog && !CompactArchive(state)) {
+        return false;
+    }
+
+    MemberEntry removed = {};
+    removed.name = filename;
+    return AppendIndex(state, {MakeRecord(removed, kRecordRemove)});
+}
+
 bool ConcatenateArchives(const std::string &archive1, const std::string &archive2, const std::string &output_archive){
     ArchiveState state1, state2;
     state1.archivePath = archive1;
@@ -380,19 +2207,42 @@ bool ConcatenateArchives(const std::string &archive1, const std::string &archive
     if(!LoadArchive(state1) || !LoadArchive(state2)){
         return false;
     }
-    auto files1 = ListFiles(state1);
-    auto files2 = ListFiles(state2);
+    // Payloads are copied without decoding, so both inputs must share one encoding.
+    if (state1.codec != state2.codec || state1.interleave != state2.interleave){
+        std::cout << "Cannot concatenate archives with different codecs or interleave depths" << std::endl;
+        return false;
+    }
 
-    std::vector<std::string> all_files;
-    all_files.insert(all_files.end(), files1.begin(), files1.end());
-    all_files.insert(all_files.end(), files2.begin(), files2.end());
-    return CreateArchive(output_archive, all_files);
+    PositionalFile file1(archive1);
+    PositionalFile file2(archive2);
+    if (!file1.IsOpen() || !file2.IsOpen()){
+        return false;
+    }
+
+    // Members of the second archive replace same-named ones from the first.
+    std::vector<MemberSource> members;
+    for (const MemberSource& member : MembersByOffset(file1, state1)){
+        if (!state2.files.Find(member.entry.name)){
+            members.push_back(member);
+        }
+    }
+    std::vector<MemberSource> second = MembersByOffset(file2, state2);
+    members.insert(members.end(), second.begin(), second.end());
+
+    // The output may be one of the inputs, which must stay readable until
+    // every payload has been copied.
+    std::string temp_path = output_archive + ".tmp";
+    if (!WriteCopiedArchive(temp_path, OptionsOf(state1), members) || !RenameFile(temp_path, output_archive)) {
+        std::remove(temp_path.c_str());
+        return false;
+    }
+    return true;
 }
 
 void PrintArchiveInfo(const ArchiveState &state){
     int i = 1;
-    for (const auto& [filename, entry] : state.files){
-        std::cout << i << ": " << filename << std::endl;
+    for (const MemberEntry* entry : state.files.SortedByName()){
+        std::cout << i << ": " << entry->name << std::endl;
         i++;
     }
 }
@@ -3,11 +3,46 @@
 
 #include <string>
 #include <vector>
-#include <map>
+#include <cstddef>
+#include <span>
+#include <memory>
+#include <string_view>
 #include <fstream>
+#include <functional>
+#include "hamming.h"
 
 namespace hamarc {
 
+// magic[3] is the format version: 1 is the original layout with Hamming(8,4)
+// payloads, 2 follows the header with a CodecHeader naming the payload codec
+// and interleave depth. 3 keeps the CodecHeader but drops the entry table:
+// payloads and index blocks are only ever appended, and the Footer at the
+// end of the file points at the latest index block. Each index block links
+// to the previous one, and replaying the chain oldest first yields the
+// member list.
+const char kFormatLegacy = '\x01';
+const char kFormatCodec = '\x02';
+const char kFormatLog = '\x03';
+
+// IndexHeader::magic[3]: a delta block lists changes in the order they
+// were made; a snapshot block is complete on its own, sorted by name so a
+// single member can be found by binary search, and always ends the chain.
+const char kIndexDelta = '\x01';
+const char kIndexSnapshot = '\x02';
+
+// How a member's data is packed before it is Hamming encoded. The payload
+// of a kCompressionDeflate member is one zlib stream; its decoded length is
+// not recorded, the stream end marks it.
+enum Compression : unsigned char {
+    kCompressionNone = 0,
+    kCompressionDeflate = 1
+};
+
+enum RecordKind : unsigned char {
+    kRecordAdd = 0,      // adds the entry, replacing a member of the same name
+    kRecordRemove = 1    // drops the member of that name
+};
+
 #pragma pack(push, 1)
 struct FileHeader {
     char magic[4] = {'H', 'A', 'F', '\x01'};
@@ -15,41 +50,251 @@ struct FileHeader {
     unsigned long long totalSize;
 };
 
+struct CodecHeader {
+    unsigned char codec;
+    unsigned char interleave;
+    unsigned char compression;   // applied to members added later
+    unsigned char reserved[5];
+};
+
 struct FileEntry {
     char filename[256];
     unsigned long long originalSize;
     unsigned long long encodedSize;
     unsigned long long offset;
 };
+// An index block is an IndexHeader, recordCount IndexRecords and a blob of
+// namesSize bytes holding the member names back to back, all Hamming(8,4)
+// encoded, followed by a Footer.
+struct IndexHeader {
+    char magic[4] = {'H', 'A', 'I', '\x01'};
+    unsigned int recordCount;
+    unsigned long long previous;   // offset of the previous index block, 0 for the first
+    unsigned long long namesSize;
+};
+
+struct IndexRecord {
+    unsigned long long originalSize;
+    unsigned long long encodedSize;
+    unsigned long long offset;     // shared by members with identical contents
+    unsigned long long contentHash;
+    unsigned int nameOffset;       // into the block's name blob
+    unsigned int nameSize;
+    unsigned char kind;
+    unsigned char compression;
+    unsigned char reserved[6];
+};
+
+struct Footer {
+    char magic[4] = {'H', 'A', 'E', '\x03'};
+    unsigned int reserved;
+    unsigned long long index;
+};
+
 struct EncodedFileHeader {
     char encoded_magic[8];    
     char encoded_fileCount[8];  
     char encoded_totalSize[16]; 
 };
 
+struct EncodedCodecHeader {
+    char encoded_codec[2];
+    char encoded_reserved[14];
+};
+
 struct EncodedFileEntry {
     char encoded_filename[512];   
     char encoded_originalSize[16];
     char encoded_encodedSize[16];
     char encoded_offset[16];
 };
+
+struct EncodedIndexHeader {
+    char encoded_magic[8];
+    char encoded_recordCount[8];
+    char encoded_previous[16];
+    char encoded_namesSize[16];
+};
+
+struct EncodedIndexRecord {
+    char encoded_originalSize[16];
+    char encoded_encodedSize[16];
+    char encoded_offset[16];
+    char encoded_contentHash[16];
+    char encoded_nameOffset[8];
+    char encoded_nameSize[8];
+    char encoded_kind[2];
+    char encoded_compression[2];
+    char encoded_reserved[12];
+};
+
+struct EncodedFooter {
+    char encoded_magic[8];
+    char encoded_reserved[8];
+    char encoded_index[16];
+};
 #pragma pack(pop)
 
+// Called with the member name while it is being encoded or decoded.
+using FileProgress = std::function<void(const std::string&, const hammingcoder::StreamProgress&)>;
+
+struct ArchiveRange {
+    unsigned long long offset;
+    unsigned long long size;
+};
+
+// One member of the archive. For entries of a MemberIndex `name` points
+// into the index's own name storage.
+struct MemberEntry {
+    std::string_view name;
+    unsigned long long originalSize;
+    unsigned long long encodedSize;
+    unsigned long long offset;
+    unsigned long long contentHash;   // XXH64 over the XXH64s of 1 MiB pieces of the original data, 0 when unknown
+    Compression compression;
+};
+
+// Members in a contiguous array, found through an open-addressing hash
+// table, with names packed into arena blocks that never move. Iteration
+// follows the array, which erasing reorders; use SortedByName() for listings.
+class MemberIndex {
+public:
+    MemberIndex() = default;
+    MemberIndex(const MemberIndex& other);
+    MemberIndex& operator=(const MemberIndex& other);
+    MemberIndex(MemberIndex&&) = default;
+    MemberIndex& operator=(MemberIndex&&) = default;
+
+    const MemberEntry* Find(std::string_view name) const;
+    void Insert(const MemberEntry& entry);   // copies the name; replaces a member of the same name
+    bool Erase(std::string_view name);
+    void Clear();
+    size_t Size() const { return entries_.size(); }
+    std::vector<const MemberEntry*> SortedByName() const;
+
+    std::vector<MemberEntry>::const_iterator begin() const { return entries_.begin(); }
+    std::vector<MemberEntry>::const_iterator end() const { return entries_.end(); }
+
+private:
+    size_t Home(std::string_view name) const;
+    size_t SlotOf(std::string_view name) const;   // the name's slot, or the free slot it would take
+    std::string_view StoreName(std::string_view name);
+    void Rehash(size_t capacity);
+
+    std::vector<MemberEntry> entries_;
+    std::vector<unsigned int> slots_;   // entry index + 1, 0 when free
+    std::vector<std::unique_ptr<char[]>> blocks_;
+    size_t block_used_ = 0;
+};
+
 struct ArchiveState {
     std::string archivePath;
-    std::map<std::string, FileEntry> files;
+    MemberIndex files;
+    hammingcoder::CodecId codec = hammingcoder::kCodecHamming84;
+    unsigned interleave = 0;
+    Compression compression = kCompressionNone;
+    FileProgress progress;
+    char format = kFormatLog;
+    bool indexLoaded = false;             // false after OpenArchive: `files` is empty, look members up lazily
+    unsigned long long lastIndex = 0;     // latest index block of a kFormatLog archive
+    unsigned deltaBlocks = 0;             // delta blocks in front of the snapshot that ends the chain
+    std::vector<ArchiveRange> metadata;   // Hamming(8,4) header, table and index bytes
+};
+
+// Read-only mapping of a whole archive. Ranges are views into the mapped
+// pages, so parsing and decoding need no intermediate copies.
+class ArchiveReader {
+public:
+    explicit ArchiveReader(const std::string& path);
+    ~ArchiveReader();
+    ArchiveReader(const ArchiveReader&) = delete;
+    ArchiveReader& operator=(const ArchiveReader&) = delete;
+
+    bool IsOpen() const { return open_; }
+    unsigned long long Size() const { return size_; }
+    // Empty when the range does not lie inside the archive.
+    std::span<const std::byte> Range(unsigned long long offset, unsigned long long size) const;
+    // Hints that [offset, offset + size) is about to be read front to back.
+    void WillRead(unsigned long long offset, unsigned long long size) const;
+
+private:
+    const std::byte* data_ = nullptr;
+    unsigned long long size_ = 0;
+    bool open_ = false;
+#ifdef _WIN32
+    void* file_ = nullptr;
+    void* mapping_ = nullptr;
+#endif
+};
+
+struct ScrubReport {
+    unsigned long long scanned = 0;     // encoded bytes read, metadata included
+    unsigned long long rewritten = 0;   // bytes written back in place
+    hammingcoder::DecodeReport decode;
+    std::vector<hammingcoder::DamagedRange> repaired;
+};
+
+struct VerifyReport {
+    unsigned long long members = 0;
+    unsigned long long unchecked = 0;     // members without a stored checksum, decoded only
+    hammingcoder::DecodeReport decode;
+    std::vector<std::string> failed;      // uncorrectable errors or checksum mismatches
+};
+
+struct CreateOptions {
+    hammingcoder::CodecId codec = hammingcoder::kCodecHamming84;
+    unsigned interleave = 0;
+    Compression compression = kCompressionNone;   // deflated members are encoded one at a time
+    unsigned threads = 0;   // encoding workers, 0 picks hardware_concurrency()
+    FileProgress progress;
 };
 
-bool CreateArchive(const std::string& archive_path, const std::vector<std::string>& file_paths);
+// kCompressionDeflate needs hamarc to be built with zlib.
+bool IsCompressionAvailable(Compression compression);
+bool CreateArchive(const std::string& archive_path, const std::vector<std::string>& file_paths,
+                   const CreateOptions& options = {});
 bool LoadArchive(ArchiveState& state);
+// Reads only the header and footer of a kFormatLog archive, leaving members
+// to be looked up on demand; older formats are loaded in full. Only
+// ExtractFile and FindMember work on an archive that was just opened.
+bool OpenArchive(ArchiveState& state);
+// Finds one member, from `files` when the index is loaded and otherwise by
+// walking the delta blocks and binary-searching the snapshot behind them.
+// On success entry.name is `name` itself.
+bool FindMember(const ArchiveState& state, const ArchiveReader& reader, std::string_view name, MemberEntry& entry);
 std::vector<std::string> ListFiles(const ArchiveState& state);
 bool ExtractFile(const ArchiveState& state, const std::string& filename, const std::string& output_path);
-bool ExtractAll(const ArchiveState& state, const std::string& output_dir);
+bool ExtractFile(const ArchiveState& state, const ArchiveReader& reader, const std::string& filename,
+                 const std::string& output_path);
+// Extracts bytes [start, end) of one member, clamped to its size. Only the
+// codewords (interleave groups) holding them are read and decoded; a
+// deflated member is inflated from its start up to `end`.
+bool ExtractRange(const ArchiveState& state, const std::string& filename, unsigned long long start,
+                  unsigned long long end, const std::string& output_path);
+// Rewrites every correctable codeword of the archive in place, member by
+// member, so single-bit errors do not pile up on disk. Uncorrectable
+// codewords are left as they are and only reported.
+bool ScrubArchive(const ArchiveState& state, ScrubReport& report);
+void PrintScrubReport(const ScrubReport& report);
+// Decodes every member on `threads` workers and compares its XXH64 with the
+// stored one, writing nothing. Members sharing a payload are checked once.
+bool VerifyArchive(const ArchiveState& state, VerifyReport& report, unsigned threads = 0);
+void PrintVerifyReport(const VerifyReport& report);
+// Extracts members on `threads` workers (0 picks hardware_concurrency()),
+// splitting large members into independent pieces. Members with
+// uncorrectable errors are removed; the others are still extracted.
+bool ExtractAll(const ArchiveState& state, const std::string& output_dir, unsigned threads = 0);
 bool ArchiveStateppendFile(ArchiveState& state, const std::string& file_path);
+// Removes a member by appending a tombstone; its payload stays in the file
+// until CompactArchive.
 bool KillFile(ArchiveState& state, const std::string& filename);
+// Rewrites the archive with only the live payloads, copied without decoding,
+// and a single index block. Also converts format 1 and 2 archives.
+bool CompactArchive(ArchiveState& state);
 bool ConcatenateArchives(const std::string& archive1, const std::string& archive2, const std::string& output_archive);
 void PrintArchiveInfo(const ArchiveState& state);
 bool ValidateArchive(std::ifstream& file, ArchiveState& state);
+bool ValidateArchive(const ArchiveReader& reader, ArchiveState& state);
 bool AppendFile(ArchiveState& state, const std::string& file_path);
 std::vector<char> EncodeHeader(const FileHeader& header);
 FileHeader DecodeHeader(const char* encoded_data);
@@ -1,5 +1,14 @@
 #include "hamming.h"
-#include <bitset>
+#include "hamming_simd.h"
+#include "secded.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <limits>
+#include <mutex>
+#include <thread>
 #include <utility>
 #include <vector>
 #include <cstring>
@@ -7,270 +16,712 @@
 
 namespace {
 
-std::bitset<7> Encode4(const std::bitset<4>& data) {
-    std::bitset<7> encoded;
-    encoded[2] = data[0];
-    encoded[4] = data[1];
-    encoded[5] = data[2];
-    encoded[6] = data[3];
-    encoded[0] = encoded[2] ^ encoded[4] ^ encoded[6];
-    encoded[1] = encoded[2] ^ encoded[5] ^ encoded[6];
-    encoded[3] = encoded[4] ^ encoded[5] ^ encoded[6];
-    return encoded;
-}
-
-std::bitset<4> Decode7(const std::bitset<7>& encoded, bool& single_error, bool& double_error) {
-    single_error = false;
-    double_error = false;
-    std::bitset<7> decoded = encoded;
-
-    bool p1 = encoded[0];
-    bool p2 = encoded[1];
-    bool p4 = encoded[3];
-    bool b1 = encoded[2];
-    bool b2 = encoded[4];
-    bool b3 = encoded[5];
-    bool b4 = encoded[6];
-
-    int s1 = p1 ^ b1 ^ b2 ^ b4;
-    int s2 = p2 ^ b1 ^ b3 ^ b4;
-    int s3 = p4 ^ b2 ^ b3 ^ b4;
-
-    int syndrome = (s3 << 2) | (s2 << 1) | s1;
-
-    if (syndrome != 0) {
-        single_error = true;
-        int err_pos = syndrome - 1;
-        if (err_pos >= 0 && err_pos < 7){
-            decoded.flip(err_pos);}
-    }
-
-    std::bitset<4> result;
-    result[0] = decoded[2];
-    result[1] = decoded[4];
-    result[2] = decoded[5];
-    result[3] = decoded[6];
-    return result;
+constexpr unsigned char kSingleErrorFlag = 0x10;
+constexpr unsigned char kDoubleErrorFlag = 0x20;
+
+constexpr bool Bit(unsigned value, int pos) {
+    return (value >> pos) & 1u;
 }
 
-bool CalculateControl(const std::bitset<7>& data) {
+constexpr unsigned char EncodeNibble(unsigned nibble) {
+    unsigned encoded = 0;
+    encoded |= Bit(nibble, 0) << 2;
+    encoded |= Bit(nibble, 1) << 4;
+    encoded |= Bit(nibble, 2) << 5;
+    encoded |= Bit(nibble, 3) << 6;
+    encoded |= (Bit(encoded, 2) ^ Bit(encoded, 4) ^ Bit(encoded, 6)) << 0;
+    encoded |= (Bit(encoded, 2) ^ Bit(encoded, 5) ^ Bit(encoded, 6)) << 1;
+    encoded |= (Bit(encoded, 4) ^ Bit(encoded, 5) ^ Bit(encoded, 6)) << 3;
+
     bool parity = false;
     for (int i = 0; i < 7; i++)
-        parity ^= data[i];
-    return parity;
+        parity ^= Bit(encoded, i);
+    if (parity)
+        encoded |= 1u << 7;
+    return static_cast<unsigned char>(encoded);
 }
 
-} // namespace
+// Decoded nibble in the low four bits, error flags above it. An odd overall
+// parity means one flipped bit, which the syndrome locates (a zero syndrome
+// means the parity bit itself flipped); a non-zero syndrome with even parity
+// means two flipped bits, which cannot be corrected.
+constexpr unsigned char DecodeCodeByte(unsigned code) {
+    unsigned s1 = Bit(code, 0) ^ Bit(code, 2) ^ Bit(code, 4) ^ Bit(code, 6);
+    unsigned s2 = Bit(code, 1) ^ Bit(code, 2) ^ Bit(code, 5) ^ Bit(code, 6);
+    unsigned s3 = Bit(code, 3) ^ Bit(code, 4) ^ Bit(code, 5) ^ Bit(code, 6);
+    unsigned syndrome = (s3 << 2) | (s2 << 1) | s1;
 
-namespace hammingcoder {
+    unsigned corrected = code & 0x7F;
+    if (syndrome != 0)
+        corrected ^= 1u << (syndrome - 1);
 
-std::pair<char,char> CodeByte(char input){
-    std::bitset<8> bits(input);
-    std::bitset<4> left_half;
-    std::bitset<4> right_half;
+    bool parity = false;
+    for (int i = 0; i < 8; i++)
+        parity ^= Bit(code, i);
+
+    unsigned result = Bit(corrected, 2)
+                    | (Bit(corrected, 4) << 1)
+                    | (Bit(corrected, 5) << 2)
+                    | (Bit(corrected, 6) << 3);
+    if (parity)
+        result |= kSingleErrorFlag;
+    else if (syndrome != 0)
+        result |= kDoubleErrorFlag;
+    return static_cast<unsigned char>(result);
+}
 
-    for (int i = 0; i < 4; i++){
-        left_half[i] = bits[i];
-        right_half[i] = bits[i+4];
+constexpr std::array<std::pair<char, char>, 256> MakeEncodeTable() {
+    std::array<std::pair<char, char>, 256> table{};
+    for (unsigned byte = 0; byte < 256; byte++) {
+        table[byte].first = static_cast<char>(EncodeNibble(byte & 0x0F));
+        table[byte].second = static_cast<char>(EncodeNibble(byte >> 4));
     }
+    return table;
+}
 
-    std::bitset<7> encode_left  = Encode4(left_half);
-    std::bitset<7> encode_right = Encode4(right_half);
+constexpr std::array<unsigned char, 256> MakeDecodeTable() {
+    std::array<unsigned char, 256> table{};
+    for (unsigned code = 0; code < 256; code++)
+        table[code] = DecodeCodeByte(code);
+    return table;
+}
 
-    bool parity_left  = CalculateControl(encode_left);
-    bool parity_right = CalculateControl(encode_right);
+constexpr std::array<std::pair<char, char>, 256> kEncodeTable = MakeEncodeTable();
+constexpr std::array<unsigned char, 256> kDecodeTable = MakeDecodeTable();
 
-    char res_left = 0;
-    char res_right = 0;
+inline char DecodePair(char first, char second, bool& single_error, bool& double_error) {
+    unsigned char left = kDecodeTable[static_cast<unsigned char>(first)];
+    unsigned char right = kDecodeTable[static_cast<unsigned char>(second)];
+    unsigned char flags = left | right;
 
-    for (int i = 0; i < 7; i++){
-        if (encode_left[i])
-            res_left |= (1 << i);
-        if (encode_right[i])
-            res_right |= (1 << i);
+    double_error = (flags & kDoubleErrorFlag) != 0;
+    single_error = !double_error && (flags & kSingleErrorFlag) != 0;
+    return static_cast<char>((left & 0x0F) | ((right & 0x0F) << 4));
+}
+
+size_t EncodeScalar(const unsigned char* data, size_t size, unsigned char* out) {
+    for (size_t i = 0; i < size; ++i) {
+        const auto& code = kEncodeTable[data[i]];
+        out[2 * i] = code.first;
+        out[2 * i + 1] = code.second;
     }
+    return size;
+}
 
-    if (parity_left)  res_left  |= (1 << 7);
-    if (parity_right) res_right |= (1 << 7);
+size_t DecodeScalar(const unsigned char* encoded, size_t pairs, unsigned char* out,
+                    size_t& correct, size_t& uncorrect) {
+    for (size_t i = 0; i < pairs; ++i) {
+        bool s, d;
+        out[i] = DecodePair(encoded[2 * i], encoded[2 * i + 1], s, d);
+        correct += s;
+        uncorrect += d;
+    }
+    return pairs;
+}
 
-    return {res_left, res_right};
+struct KernelOps {
+    hammingcoder::simd::EncodeKernel encode;
+    hammingcoder::simd::DecodeKernel decode;
+};
+
+KernelOps OpsFor(hammingcoder::Kernel kernel) {
+    switch (kernel) {
+        case hammingcoder::kKernelSse41:
+            return {hammingcoder::simd::EncodeSse41, hammingcoder::simd::DecodeSse41};
+        case hammingcoder::kKernelAvx2:
+            return {hammingcoder::simd::EncodeAvx2, hammingcoder::simd::DecodeAvx2};
+        case hammingcoder::kKernelAvx512:
+            return {hammingcoder::simd::EncodeAvx512, hammingcoder::simd::DecodeAvx512};
+        default:
+            return {EncodeScalar, DecodeScalar};
+    }
 }
 
-char DecodeByte(char first, char second, bool& single_error, bool& double_error, bool& parity_error){
-    single_error = false;
-    double_error = false;
-    parity_error = false;
+hammingcoder::Kernel DetectKernel() {
+    if (hammingcoder::simd::CpuHasAvx512()) return hammingcoder::kKernelAvx512;
+    if (hammingcoder::simd::CpuHasAvx2()) return hammingcoder::kKernelAvx2;
+    if (hammingcoder::simd::CpuHasSse41()) return hammingcoder::kKernelSse41;
+    return hammingcoder::kKernelScalar;
+}
+
+// Pipeline workers read the choice while SelectKernel() may change it, so
+// it is atomic; each range resolves it once.
+std::atomic<hammingcoder::Kernel>& CurrentKernel() {
+    static std::atomic<hammingcoder::Kernel> kernel{DetectKernel()};
+    return kernel;
+}
+
+void EncodeRange(const char* data, size_t size, char* out) {
+    auto in = reinterpret_cast<const unsigned char*>(data);
+    auto dst = reinterpret_cast<unsigned char*>(out);
+    size_t done = OpsFor(CurrentKernel().load(std::memory_order_relaxed)).encode(in, size, dst);
+    EncodeScalar(in + done, size - done, dst + 2 * done);
+}
+
+void DecodeRange(const char* encoded, size_t pairs, char* out, size_t& correct, size_t& uncorrect) {
+    auto in = reinterpret_cast<const unsigned char*>(encoded);
+    auto dst = reinterpret_cast<unsigned char*>(out);
+    size_t done = OpsFor(CurrentKernel().load(std::memory_order_relaxed)).decode(in, pairs, dst, correct, uncorrect);
+    DecodeScalar(in + 2 * done, pairs - done, dst + done, correct, uncorrect);
+}
+
+void DecodeRange(const char* encoded, size_t pairs, char* out, int& correct, int& uncorrect) {
+    size_t fixed = 0, broken = 0;
+    DecodeRange(encoded, pairs, out, fixed, broken);
+    correct += static_cast<int>(fixed);
+    uncorrect += static_cast<int>(broken);
+}
+
+struct PipelineSlot {
+    std::vector<std::byte> input;
+    std::vector<std::byte> output;
+    size_t input_size = 0;
+    size_t output_size = 0;
+    uint64_t position = 0;
+    hammingcoder::DecodeReport report;
+};
+
+class Hamming84Codec : public hammingcoder::Codec {
+public:
+    hammingcoder::CodecId Id() const override { return hammingcoder::kCodecHamming84; }
+    const char* Name() const override { return "hamming84"; }
+    size_t DataUnit() const override { return 1; }
+    size_t CodeUnit() const override { return 2; }
+    size_t CodewordSize() const override { return 1; }
+
+    size_t EncodeInto(std::span<const std::byte> in, std::span<std::byte> out) const override {
+        return hammingcoder::EncodeInto(in, out);
+    }
+
+    size_t DecodeInto(std::span<const std::byte> in, std::span<std::byte> out, hammingcoder::DecodeReport& report,
+                      uint64_t stream_offset) const override {
+        return hammingcoder::DecodeInto(in, out, report, stream_offset);
+    }
+};
+
+unsigned ThreadCount(const hammingcoder::StreamOptions& options) {
+    if (options.threads != 0) {
+        return options.threads;
+    }
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Reads fixed-size blocks on the calling thread, transforms them on `threads`
+// workers and writes them back in input order from a dedicated writer thread.
+// A ring of 2 * threads slots bounds memory and lets all three stages overlap.
+template <typename Process, typename OnRead, typename OnWritten>
+void RunPipeline(std::istream& input, std::ostream& output, size_t input_block, size_t output_block,
+                 unsigned threads, Process process, OnRead on_read, OnWritten on_written) {
+    if (threads <= 1) {
+        PipelineSlot slot;
+        slot.input.resize(input_block);
+        slot.output.resize(output_block);
+        while (input.read(reinterpret_cast<char*>(slot.input.data()), input_block) || input.gcount() > 0) {
+            slot.input_size = input.gcount();
+            on_read(slot.input_size);
+            process(slot);
+            slot.position += slot.input_size;
+            output.write(reinterpret_cast<const char*>(slot.output.data()), slot.output_size);
+            on_written(slot);
+            if (!output) {
+                break;
+            }
+        }
+        return;
+    }
 
-    std::bitset<7> encode_left;
-    std::bitset<7> encode_right;
+    enum SlotState { kSlotFree, kSlotQueued, kSlotDone };
+
+    const size_t slot_count = 2 * static_cast<size_t>(threads);
+    std::vector<PipelineSlot> slots(slot_count);
+    std::vector<SlotState> states(slot_count, kSlotFree);
+    std::deque<size_t> queue;
+    size_t blocks_read = 0;
+    uint64_t position = 0;
+    bool reading_done = false;
+    bool failed = false;
+
+    std::mutex mutex;
+    std::condition_variable slot_freed;
+    std::condition_variable work_ready;
+    std::condition_variable block_done;
+
+    auto worker = [&] {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            work_ready.wait(lock, [&] { return !queue.empty() || reading_done || failed; });
+            if (queue.empty() || failed) {
+                return;
+            }
+            size_t index = queue.front();
+            queue.pop_front();
+            lock.unlock();
+            process(slots[index]);
+            lock.lock();
+            states[index] = kSlotDone;
+            block_done.notify_one();
+        }
+    };
+
+    auto writer = [&] {
+        for (size_t seq = 0;; seq++) {
+            size_t index = seq % slot_count;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                block_done.wait(lock, [&] {
+                    return states[index] == kSlotDone || (reading_done && seq >= blocks_read) || failed;
+                });
+                if (states[index] != kSlotDone || failed) {
+                    return;
+                }
+            }
+            output.write(reinterpret_cast<const char*>(slots[index].output.data()), slots[index].output_size);
+            on_written(slots[index]);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            states[index] = kSlotFree;
+            if (!output) {
+                failed = true;
+                work_ready.notify_all();
+            }
+            slot_freed.notify_one();
+        }
+    };
 
-    bool stored_parity_left  = (first  & (1 << 7)) != 0;
-    bool stored_parity_right = (second & (1 << 7)) != 0;
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < threads; i++) {
+        workers.emplace_back(worker);
+    }
+    std::thread writer_thread(writer);
+
+    for (size_t seq = 0;; seq++) {
+        size_t index = seq % slot_count;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            slot_freed.wait(lock, [&] { return states[index] == kSlotFree || failed; });
+            if (failed) {
+                break;
+            }
+        }
 
-    for (int i = 0; i < 7; i++){
-        encode_left[i]  = (first  & (1 << i)) != 0;
-        encode_right[i] = (second & (1 << i)) != 0;
+        PipelineSlot& slot = slots[index];
+        slot.input.resize(input_block);
+        slot.output.resize(output_block);
+        input.read(reinterpret_cast<char*>(slot.input.data()), input_block);
+        slot.input_size = input.gcount();
+        if (slot.input_size == 0) {
+            break;
+        }
+        slot.position = position;
+        position += slot.input_size;
+        on_read(slot.input_size);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        states[index] = kSlotQueued;
+        queue.push_back(index);
+        blocks_read = seq + 1;
+        work_ready.notify_one();
+        if (slot.input_size < input_block) {
+            break;
+        }
     }
 
-    bool calc_left  = CalculateControl(encode_left);
-    bool calc_right = CalculateControl(encode_right);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        reading_done = true;
+    }
+    work_ready.notify_all();
+    block_done.notify_all();
 
-    bool mismatch_left  = (calc_left  != stored_parity_left);
-    bool mismatch_right = (calc_right != stored_parity_right);
+    for (auto& thread : workers) {
+        thread.join();
+    }
+    writer_thread.join();
+}
 
-    bool s1=false, s2=false;
-    bool d1 = false, d2 = false;
-    std::bitset<4> dec_left  = Decode7(encode_left,  s1, d1);
-    std::bitset<4> dec_right = Decode7(encode_right, s2, d2);
+uint64_t RemainingSize(std::istream& input) {
+    std::istream::pos_type start = input.tellg();
+    if (start == std::istream::pos_type(-1)) {
+        input.clear();
+        return 0;
+    }
+    input.seekg(0, std::ios::end);
+    std::istream::pos_type end = input.tellg();
+    input.seekg(start);
+    if (!input || end == std::istream::pos_type(-1) || end < start) {
+        input.clear();
+        input.seekg(start);
+        return 0;
+    }
+    return static_cast<uint64_t>(end - start);
+}
+
+template <typename Process, typename OnRead>
+void RunPipeline(std::istream& input, std::ostream& output, size_t input_block, size_t output_block,
+                 unsigned threads, Process process, OnRead on_read) {
+    RunPipeline(input, output, input_block, output_block, threads, process, on_read,
+                [](const PipelineSlot&) {});
+}
+
+} // namespace
+
+namespace hammingcoder {
 
-    if (s1 || s2)
-        single_error = true;
-    if (d1 || d2){
-        double_error = true;
+void DecodeReport::AddDamage(uint64_t offset, uint64_t length){
+    if (!damaged.empty() && damaged.back().offset + damaged.back().length == offset) {
+        damaged.back().length += length;
+        return;
     }
-    if ((mismatch_left || mismatch_right) && !single_error)
-        double_error = true;
+    damaged.push_back({offset, length});
+}
 
-    char result = 0;
+void DecodeReport::Merge(const DecodeReport& other){
+    corrected += other.corrected;
+    uncorrectable += other.uncorrectable;
+    for (const auto& range : other.damaged) {
+        AddDamage(range.offset, range.length);
+    }
+}
+
+ProgressMeter::ProgressMeter(ProgressCallback callback, uint64_t bytes_total,
+                             std::chrono::milliseconds interval)
+    : callback_(std::move(callback)), interval_(interval), start_(Clock::now()), last_report_(start_) {
+    progress_.bytes_total = bytes_total;
+}
 
-    for (int i = 0; i < 4; i++){
-        if (dec_left[i])
-            result |= (1 << i);
-        if (dec_right[i])
-            result |= (1 << (i+4));
+void ProgressMeter::Advance(uint64_t bytes, uint64_t corrected, uint64_t uncorrectable){
+    progress_.bytes_done += bytes;
+    progress_.corrected += corrected;
+    progress_.uncorrectable += uncorrectable;
+    if (!callback_) {
+        return;
     }
 
-    return result;
+    Clock::time_point now = Clock::now();
+    if (now - last_report_ < interval_) {
+        return;
+    }
+    std::chrono::duration<double> elapsed = now - last_report_;
+    progress_.bytes_per_second = elapsed.count() > 0 ? (progress_.bytes_done - last_bytes_) / elapsed.count() : 0;
+    last_report_ = now;
+    last_bytes_ = progress_.bytes_done;
+    callback_(progress_);
+}
+
+void ProgressMeter::Finish(){
+    if (!callback_ || progress_.finished) {
+        return;
+    }
+    std::chrono::duration<double> elapsed = Clock::now() - start_;
+    progress_.bytes_per_second = elapsed.count() > 0 ? progress_.bytes_done / elapsed.count() : 0;
+    progress_.finished = true;
+    callback_(progress_);
+}
+
+uint64_t Codec::EncodedSize(uint64_t size) const {
+    return (size + DataUnit() - 1) / DataUnit() * CodeUnit();
+}
+
+uint64_t Codec::DecodedSize(uint64_t encoded_size) const {
+    return encoded_size / CodeUnit() * DataUnit();
+}
+
+const Codec* FindCodec(CodecId id){
+    static const Hamming84Codec hamming84;
+    switch (id) {
+        case kCodecHamming84: return &hamming84;
+        case kCodecSecded7264: return &Secded7264Codec();
+    }
+    return nullptr;
+}
+
+const Codec* FindCodec(const std::string& name){
+    for (CodecId id : {kCodecHamming84, kCodecSecded7264}) {
+        const Codec* codec = FindCodec(id);
+        if (name == codec->Name()) {
+            return codec;
+        }
+    }
+    return nullptr;
+}
+
+const Codec& GetCodec(CodecId id){
+    const Codec* codec = FindCodec(id);
+    return codec ? *codec : *FindCodec(kCodecHamming84);
+}
+
+bool IsKernelSupported(Kernel kernel){
+    switch (kernel) {
+        case kKernelScalar: return true;
+        case kKernelSse41: return simd::CpuHasSse41();
+        case kKernelAvx2: return simd::CpuHasAvx2();
+        case kKernelAvx512: return simd::CpuHasAvx512();
+    }
+    return false;
+}
+
+Kernel ActiveKernel(){
+    return CurrentKernel().load();
+}
+
+bool SelectKernel(Kernel kernel){
+    if (!IsKernelSupported(kernel)) {
+        return false;
+    }
+    CurrentKernel().store(kernel);
+    return true;
+}
+
+std::pair<char,char> CodeByte(char input){
+    return kEncodeTable[static_cast<unsigned char>(input)];
+}
+
+char DecodeByte(char first, char second, bool& single_error, bool& double_error, bool& parity_error){
+    parity_error = false;
+    return DecodePair(first, second, single_error, double_error);
 }
 
 bool IsValid(const std::pair<char,char>& encoded){
-    bool s,d,p;
-    DecodeByte(encoded.first, encoded.second, s, d, p);
+    bool s,d;
+    DecodePair(encoded.first, encoded.second, s, d);
     return !d;
 }
 
 std::vector<char> EncodeData(const std::vector<char>& data){
-    std::vector<char> encoded;
-    encoded.reserve(data.size()*2);
-
-    for (char byte : data){
-        auto p = CodeByte(byte);
-        encoded.push_back(p.first);
-        encoded.push_back(p.second);
-    }
-    return encoded;
+    return EncodeBuffer(data.data(), data.size());
 }
 
 std::vector<char> DecodeData(const std::vector<char>& encoded, int& correct, int& uncorrect){
-    std::vector<char> decoded;
-    decoded.reserve(encoded.size()/2);
-
     correct = 0;
     uncorrect = 0;
 
-    for(size_t i = 0; i < encoded.size(); i+=2){
-        bool s,d,p;
-        char byte = DecodeByte(encoded[i], encoded[i+1], s, d, p);
-        decoded.push_back(byte);
-
-        if (s) correct++;
-        if (d) uncorrect++;
-    }
+    std::vector<char> decoded(encoded.size() / 2);
+    DecodeRange(encoded.data(), decoded.size(), decoded.data(), correct, uncorrect);
     return decoded;
 }
+
 std::vector<char> EncodeBuffer(const char* data, size_t size) {
-    std::vector<char> result;
-    result.reserve(size * 2); 
-    
-    for (size_t i = 0; i < size; ++i) {
-        auto encoded_pair = CodeByte(data[i]);
-        result.push_back(encoded_pair.first);
-        result.push_back(encoded_pair.second);
-    }
-    
+    std::vector<char> result(size * 2);
+    EncodeRange(data, size, result.data());
     return result;
 }
 
+size_t EncodeInto(std::span<const std::byte> in, std::span<std::byte> out) {
+    if (out.size() < 2 * in.size()) {
+        return 0;
+    }
+    EncodeRange(reinterpret_cast<const char*>(in.data()), in.size(), reinterpret_cast<char*>(out.data()));
+    return 2 * in.size();
+}
+
+size_t DecodeInto(std::span<const std::byte> in, std::span<std::byte> out, size_t& correct, size_t& uncorrect) {
+    size_t pairs = in.size() / 2;
+    if (out.size() < pairs) {
+        return 0;
+    }
+    DecodeRange(reinterpret_cast<const char*>(in.data()), pairs, reinterpret_cast<char*>(out.data()),
+                correct, uncorrect);
+    return pairs;
+}
+
+size_t DecodeInto(std::span<const std::byte> in, std::span<std::byte> out, DecodeReport& report,
+                  uint64_t stream_offset) {
+    size_t correct = 0, uncorrect = 0;
+    size_t pairs = DecodeInto(in, out, correct, uncorrect);
+    if (pairs == 0) {
+        return 0;
+    }
+    report.corrected += correct;
+    report.uncorrectable += uncorrect;
+
+    if (uncorrect > 0) {
+        auto encoded = reinterpret_cast<const char*>(in.data());
+        for (size_t i = 0; i < pairs; i++) {
+            bool s, d;
+            DecodePair(encoded[2 * i], encoded[2 * i + 1], s, d);
+            if (d) {
+                report.AddDamage(stream_offset + 2 * i, 2);
+            }
+        }
+    }
+    return pairs;
+}
+
 std::vector<char> DecodeBuffer(const char* encoded_data, size_t encoded_size, int& correct, int& uncorrect) {
     std::vector<char> result;
-    if (encoded_size % 2 != 0) return result; 
-    
-    result.reserve(encoded_size / 2);
+    if (encoded_size % 2 != 0) return result;
+
     correct = 0;
     uncorrect = 0;
-    
-    for (size_t i = 0; i < encoded_size; i += 2) {
-        bool single_error = false, double_error = false, parity_error = false;
-        char decoded_byte = DecodeByte(encoded_data[i], encoded_data[i+1], 
-                                      single_error, double_error, parity_error);
-        result.push_back(decoded_byte);
-        
-        if (single_error) correct++;
-        if (double_error) uncorrect++;
-    }
-    
+    result.resize(encoded_size / 2);
+    DecodeRange(encoded_data, result.size(), result.data(), correct, uncorrect);
     return result;
 }
 
-void EncodeStream(std::istream& input, std::ostream& output, 
-                 std::function<void(size_t, size_t)> progress_callback) {
-    const size_t buffer_size = 64 * 1024; 
-    std::vector<char> input_buffer(buffer_size);
-    std::vector<char> output_buffer;
-    output_buffer.reserve(buffer_size * 2); 
-    
-    size_t total_read = 0;
-    
-    while (input.read(input_buffer.data(), buffer_size) || input.gcount() > 0) {
-        size_t bytes_read = input.gcount();
-        total_read += bytes_read;
-        
-        
-        std::vector<char> block_data(input_buffer.begin(), input_buffer.begin() + bytes_read);
-        std::vector<char> encoded_block = EncodeData(block_data);
-        
-        
-        output.write(encoded_block.data(), encoded_block.size());
-        
-        if (progress_callback) {
-            progress_callback(total_read, total_read);
+size_t AlignedBlockSize(const StreamOptions& options) {
+    const Codec& codec = GetCodec(options.codec);
+    size_t unit = codec.DataUnit();
+    if (options.interleave != 0) {
+        unit = InterleaveGroupSize(codec, options.interleave) / codec.CodeUnit() * codec.DataUnit();
+    }
+    return std::max<size_t>((options.block_size + unit - 1) / unit * unit, unit);
+}
+
+uint64_t EncodedStreamSize(uint64_t size, const StreamOptions& options) {
+    const Codec& codec = GetCodec(options.codec);
+    uint64_t encoded = codec.EncodedSize(size);
+    if (options.interleave == 0) {
+        return encoded;
+    }
+    uint64_t group = InterleaveGroupSize(codec, options.interleave);
+    return (encoded + group - 1) / group * group;
+}
+
+size_t EncodeBlock(std::span<const std::byte> in, std::span<std::byte> out, const StreamOptions& options) {
+    const Codec& codec = GetCodec(options.codec);
+    size_t total = EncodedStreamSize(in.size(), options);
+    if (out.size() < total) {
+        return 0;
+    }
+
+    size_t encoded = codec.EncodeInto(in, out);
+    if (options.interleave != 0) {
+        std::fill(out.begin() + encoded, out.begin() + total, std::byte{0});
+        Interleave(out.first(total), codec.CodewordSize(), options.interleave);
+    }
+    return total;
+}
+
+size_t DecodeBlock(std::span<std::byte> in, std::span<std::byte> out, DecodeReport& report,
+                   uint64_t stream_offset, const StreamOptions& options) {
+    const Codec& codec = GetCodec(options.codec);
+    if (options.interleave == 0) {
+        return codec.DecodeInto(in, out, report, stream_offset);
+    }
+
+    const size_t group = InterleaveGroupSize(codec, options.interleave);
+    Deinterleave(in, codec.CodewordSize(), options.interleave);
+
+    DecodeReport block;
+    size_t decoded = codec.DecodeInto(in, out, block, stream_offset);
+    report.corrected += block.corrected;
+    report.uncorrectable += block.uncorrectable;
+
+    uint64_t last_end = 0;
+    for (const auto& range : block.damaged) {
+        uint64_t start = stream_offset + (range.offset - stream_offset) / group * group;
+        uint64_t end = stream_offset + (range.offset + range.length - stream_offset + group - 1) / group * group;
+        start = std::max(start, last_end);
+        if (start < end) {
+            report.AddDamage(start, end - start);
+            last_end = end;
         }
-        
-        
-        output_buffer.clear();
     }
+    return decoded;
 }
 
+size_t RepairBlock(std::span<std::byte> encoded, DecodeReport& report, std::vector<DamagedRange>& repaired,
+                   uint64_t stream_offset, const StreamOptions& options) {
+    const Codec& codec = GetCodec(options.codec);
+    std::vector<std::byte> scratch(encoded.begin(), encoded.end());
+    std::vector<std::byte> decoded(codec.DecodedSize(encoded.size()));
 
-void DecodeStream(std::istream& input, std::ostream& output, 
-                 int& correct_errors, int& uncorrect_errors) {
-    const size_t buffer_size = 128 * 1024; 
-    std::vector<char> input_buffer(buffer_size);
-    std::vector<char> output_buffer;
-    
-    correct_errors = 0;
-    uncorrect_errors = 0;
-    size_t total_read = 0;
-    
-    while (input.read(input_buffer.data(), buffer_size) || input.gcount() > 0) {
-        size_t bytes_read = input.gcount();
-        total_read += bytes_read;
-        
-        
-        std::vector<char> encoded_block(input_buffer.begin(), input_buffer.begin() + bytes_read);
-        
-        int block_correct, block_uncorrect;
-        std::vector<char> decoded_block = DecodeData(encoded_block, block_correct, block_uncorrect);
-        
-        correct_errors += block_correct;
-        uncorrect_errors += block_uncorrect;
-        
-        if (!decoded_block.empty()) {
-            output.write(decoded_block.data(), decoded_block.size());
+    DecodeReport block;
+    decoded.resize(DecodeBlock(scratch, decoded, block, stream_offset, options));
+    if (EncodeBlock(decoded, scratch, options) != encoded.size()) {
+        return 0;
+    }
+
+    size_t rewritten = 0;
+    auto damaged = block.damaged.begin();
+    size_t i = 0;
+    while (i < encoded.size()) {
+        while (damaged != block.damaged.end() && damaged->offset + damaged->length <= stream_offset + i) {
+            ++damaged;
+        }
+        if (damaged != block.damaged.end() && damaged->offset <= stream_offset + i) {
+            i = damaged->offset + damaged->length - stream_offset;
+            continue;
+        }
+        if (scratch[i] == encoded[i]) {
+            i++;
+            continue;
+        }
+
+        size_t limit = encoded.size();
+        if (damaged != block.damaged.end()) {
+            limit = std::min<size_t>(limit, damaged->offset - stream_offset);
+        }
+        size_t end = i + 1;
+        while (end < limit && scratch[end] != encoded[end]) {
+            end++;
+        }
+        std::copy(scratch.begin() + i, scratch.begin() + end, encoded.begin() + i);
+        if (!repaired.empty() && repaired.back().offset + repaired.back().length == stream_offset + i) {
+            repaired.back().length += end - i;
+        } else {
+            repaired.push_back({stream_offset + i, end - i});
         }
-        
-        
+        rewritten += end - i;
+        i = end;
     }
+
+    report.Merge(block);
+    return rewritten;
+}
+
+void EncodeStream(std::istream& input, std::ostream& output,
+                 std::function<void(size_t, size_t)> progress_callback, const StreamOptions& options) {
+    const size_t block_size = AlignedBlockSize(options);
+    const uint64_t input_size = RemainingSize(input);
+    size_t total_read = 0;
+    ProgressMeter meter(options.progress, input_size, options.progress_interval);
+
+    RunPipeline(input, output, block_size, EncodedStreamSize(block_size, options), ThreadCount(options),
+        [&](PipelineSlot& slot) {
+            slot.output_size = EncodeBlock(std::span(slot.input).first(slot.input_size), slot.output, options);
+        },
+        [&](size_t bytes_read) {
+            total_read += bytes_read;
+            if (progress_callback) {
+                progress_callback(total_read, input_size != 0 ? input_size : total_read);
+            }
+        },
+        [&](const PipelineSlot& slot) {
+            meter.Advance(slot.input_size);
+        });
+    meter.Finish();
+}
+
+void DecodeStream(std::istream& input, std::ostream& output,
+                 int& correct_errors, int& uncorrect_errors, const StreamOptions& options) {
+    DecodeReport report;
+    DecodeStream(input, output, report, options);
+
+    const uint64_t limit = std::numeric_limits<int>::max();
+    correct_errors = static_cast<int>(std::min(report.corrected, limit));
+    uncorrect_errors = static_cast<int>(std::min(report.uncorrectable, limit));
+}
+
+void DecodeStream(std::istream& input, std::ostream& output, DecodeReport& report,
+                  const StreamOptions& options) {
+    const size_t block_size = AlignedBlockSize(options);
+    ProgressMeter meter(options.progress, RemainingSize(input), options.progress_interval);
+
+    RunPipeline(input, output, EncodedStreamSize(block_size, options), block_size, ThreadCount(options),
+        [&](PipelineSlot& slot) {
+            slot.report.corrected = 0;
+            slot.report.uncorrectable = 0;
+            slot.report.damaged.clear();
+            slot.output_size = DecodeBlock(std::span(slot.input).first(slot.input_size), slot.output,
+                                           slot.report, slot.position, options);
+        },
+        [](size_t) {},
+        [&](const PipelineSlot& slot) {
+            report.Merge(slot.report);
+            meter.Advance(slot.input_size, slot.report.corrected, slot.report.uncorrectable);
+        });
+    meter.Finish();
 }
 
 }// namespace hamingcoder
@@ -3,20 +3,159 @@
 
 #include <vector>
 #include <bitset>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
+#include <span>
+#include <string>
 
 
 namespace hammingcoder {
+    enum Kernel {
+        kKernelScalar,
+        kKernelSse41,
+        kKernelAvx2,
+        kKernelAvx512
+    };
+
+    bool IsKernelSupported(Kernel kernel);
+    Kernel ActiveKernel();
+    bool SelectKernel(Kernel kernel);
+
+    enum CodecId : unsigned char {
+        kCodecHamming84 = 0,   // two Hamming(7,4)+parity bytes per data byte, legacy format
+        kCodecSecded7264 = 1   // extended Hamming(72,64): eight data bytes plus one check byte
+    };
+
+    // Byte counts refer to the stream's input: plain data when encoding,
+    // encoded data when decoding.
+    struct StreamProgress {
+        uint64_t bytes_done = 0;
+        uint64_t bytes_total = 0;        // 0 when the input is not seekable
+        double bytes_per_second = 0;     // since the previous report; whole run once finished
+        uint64_t corrected = 0;
+        uint64_t uncorrectable = 0;
+        bool finished = false;
+    };
+
+    using ProgressCallback = std::function<void(const StreamProgress&)>;
+
+    // Calls the callback at most once per interval, and always once from
+    // Finish(), so per-block updates stay cheap. Advance() takes deltas.
+    class ProgressMeter {
+    public:
+        ProgressMeter(ProgressCallback callback, uint64_t bytes_total,
+                      std::chrono::milliseconds interval = std::chrono::milliseconds(200));
+
+        void Advance(uint64_t bytes, uint64_t corrected = 0, uint64_t uncorrectable = 0);
+        void Finish();
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        ProgressCallback callback_;
+        std::chrono::milliseconds interval_;
+        StreamProgress progress_;
+        Clock::time_point start_;
+        Clock::time_point last_report_;
+        uint64_t last_bytes_ = 0;
+    };
+
+    struct StreamOptions {
+        unsigned threads = 0;          // 0 picks std::thread::hardware_concurrency()
+        size_t block_size = 1 << 20;   // decoded bytes handed to one worker
+        CodecId codec = kCodecHamming84;
+        unsigned interleave = 0;       // codewords spread per group: 0 (off), 8, 16, 32 or 64
+        ProgressCallback progress;
+        std::chrono::milliseconds progress_interval{200};
+    };
+
+    struct DamagedRange {
+        uint64_t offset;   // encoded byte offset from the start of the stream
+        uint64_t length;
+    };
+
+    struct DecodeReport {
+        uint64_t corrected = 0;
+        uint64_t uncorrectable = 0;
+        std::vector<DamagedRange> damaged;   // uncorrectable codewords, adjacent ones merged
+
+        void AddDamage(uint64_t offset, uint64_t length);
+        void Merge(const DecodeReport& other);
+    };
+
+    // Error-correcting scheme used for member payloads. Data is handled in
+    // units of DataUnit() bytes, each encoded into CodeUnit() bytes; a short
+    // final unit is zero-padded, so decoding may yield up to DataUnit() - 1
+    // extra bytes that the caller trims to the original size.
+    class Codec {
+    public:
+        virtual ~Codec() = default;
+        virtual CodecId Id() const = 0;
+        virtual const char* Name() const = 0;
+        virtual size_t DataUnit() const = 0;
+        virtual size_t CodeUnit() const = 0;
+        virtual size_t CodewordSize() const = 0;   // bytes that share one single-bit correction
+        virtual size_t EncodeInto(std::span<const std::byte> in, std::span<std::byte> out) const = 0;
+        virtual size_t DecodeInto(std::span<const std::byte> in, std::span<std::byte> out, DecodeReport& report,
+                                  uint64_t stream_offset = 0) const = 0;
+
+        uint64_t EncodedSize(uint64_t size) const;
+        uint64_t DecodedSize(uint64_t encoded_size) const;
+    };
+
+    const Codec* FindCodec(CodecId id);
+    const Codec* FindCodec(const std::string& name);
+    const Codec& GetCodec(CodecId id);
+
+    // Bit interleaving spreads every codeword of a group over the whole
+    // group, so a burst of up to `depth` flipped bits hits each codeword at
+    // most once. Spans must hold whole groups of depth * codeword_size bytes.
+    bool IsValidInterleave(unsigned depth);
+    size_t InterleaveGroupSize(const Codec& codec, unsigned depth);
+    void Interleave(std::span<std::byte> encoded, size_t codeword_size, unsigned depth);
+    void Deinterleave(std::span<std::byte> encoded, size_t codeword_size, unsigned depth);
+
+    // Codec plus optional interleaving, as applied by the stream functions.
+    // Interleaved output is zero-padded to whole groups; DecodeBlock
+    // deinterleaves `in` in place and reports damage at group granularity.
+    size_t AlignedBlockSize(const StreamOptions& options);
+    uint64_t EncodedStreamSize(uint64_t size, const StreamOptions& options);
+    size_t EncodeBlock(std::span<const std::byte> in, std::span<std::byte> out, const StreamOptions& options);
+    size_t DecodeBlock(std::span<std::byte> in, std::span<std::byte> out, DecodeReport& report,
+                       uint64_t stream_offset, const StreamOptions& options);
+
+    // Re-encodes the codewords of `encoded` that decode with a correctable
+    // error, leaving uncorrectable ones (whole groups when interleaved)
+    // untouched. `encoded` must hold whole units or groups. Rewritten byte
+    // ranges are appended to `repaired`; returns how many bytes changed.
+    size_t RepairBlock(std::span<std::byte> encoded, DecodeReport& report, std::vector<DamagedRange>& repaired,
+                       uint64_t stream_offset, const StreamOptions& options);
+
     std::pair<char,char> CodeByte(char input);
     char DecodeByte(char first, char second,bool& single_error, bool& double_error, bool& parity_error);
     bool IsValid(const std::pair<char,char>& encoded);
     std::vector<char> EncodeData(const std::vector<char>& data);
     std::vector<char> DecodeData(const std::vector<char>& encoded, int& correct, int& uncorrect);
     std::vector<char> EncodeBuffer(const char* data, size_t size);
+    // Write into caller-owned buffers without allocating. `out` must hold
+    // 2 * in.size() bytes for encoding and in.size() / 2 for decoding;
+    // both return the number of bytes written, or 0 if `out` is too small.
+    // Decoding adds to the counters instead of resetting them.
+    size_t EncodeInto(std::span<const std::byte> in, std::span<std::byte> out);
+    size_t DecodeInto(std::span<const std::byte> in, std::span<std::byte> out, size_t& correct, size_t& uncorrect);
+    size_t DecodeInto(std::span<const std::byte> in, std::span<std::byte> out, DecodeReport& report,
+                      uint64_t stream_offset = 0);
     std::vector<char> DecodeBuffer(const char* encoded_data, size_t encoded_size, int& correct, int& uncorrect);
-    void EncodeStream(std::istream& input, std::ostream& output, std::function<void(size_t, size_t)> progress_callback = nullptr);
+    // progress_callback receives (bytes read, input size) after every block;
+    // the size is the bytes read so far when the input is not seekable.
+    void EncodeStream(std::istream& input, std::ostream& output, std::function<void(size_t, size_t)> progress_callback = nullptr,
+                      const StreamOptions& options = {});
     void DecodeStream(std::istream& input, std::ostream& output, 
-                     int& correct_errors, int& uncorrect_errors);
+                     int& correct_errors, int& uncorrect_errors, const StreamOptions& options = {});
+    void DecodeStream(std::istream& input, std::ostream& output, DecodeReport& report,
+                      const StreamOptions& options = {});
 }
 
 
@@ -0,0 +1,346 @@
+#include "hamming_simd.h"
+#include <array>
+#include <cstdint>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define HAMMING_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// Every table is indexed by a nibble so that it fits one pshufb lookup.
+// A code byte c decodes through DecodeLow[c & 0xF] ^ DecodeHigh[c >> 4]:
+// bits 0-3 hold the raw data nibble, bits 4-6 the syndrome, bit 7 the
+// parity of all eight bits. SyndromeFix[syndrome] is the data nibble
+// correction for a single flipped bit.
+
+constexpr bool Bit(unsigned value, int pos) {
+    return (value >> pos) & 1u;
+}
+
+constexpr unsigned char CodeBitContribution(int pos) {
+    unsigned value = 0x80;
+    if (pos == 2) value |= 0x1;
+    if (pos == 4) value |= 0x2;
+    if (pos == 5) value |= 0x4;
+    if (pos == 6) value |= 0x8;
+    if (pos == 0 || pos == 2 || pos == 4 || pos == 6) value |= 0x10;
+    if (pos == 1 || pos == 2 || pos == 5 || pos == 6) value |= 0x20;
+    if (pos == 3 || pos == 4 || pos == 5 || pos == 6) value |= 0x40;
+    return static_cast<unsigned char>(value);
+}
+
+constexpr unsigned char EncodeNibble(unsigned nibble) {
+    unsigned encoded = (Bit(nibble, 0) << 2) | (Bit(nibble, 1) << 4)
+                     | (Bit(nibble, 2) << 5) | (Bit(nibble, 3) << 6);
+    encoded |= (Bit(encoded, 2) ^ Bit(encoded, 4) ^ Bit(encoded, 6)) << 0;
+    encoded |= (Bit(encoded, 2) ^ Bit(encoded, 5) ^ Bit(encoded, 6)) << 1;
+    encoded |= (Bit(encoded, 4) ^ Bit(encoded, 5) ^ Bit(encoded, 6)) << 3;
+    unsigned parity = 0;
+    for (int i = 0; i < 7; i++)
+        parity ^= Bit(encoded, i);
+    return static_cast<unsigned char>(encoded | (parity << 7));
+}
+
+constexpr std::array<unsigned char, 16> MakeEncodeNibble() {
+    std::array<unsigned char, 16> table{};
+    for (unsigned n = 0; n < 16; n++)
+        table[n] = EncodeNibble(n);
+    return table;
+}
+
+constexpr std::array<unsigned char, 16> MakeDecodeNibble(int shift) {
+    std::array<unsigned char, 16> table{};
+    for (unsigned n = 0; n < 16; n++) {
+        unsigned char value = 0;
+        for (int i = 0; i < 4; i++) {
+            if (Bit(n, i))
+                value ^= CodeBitContribution(i + shift);
+        }
+        table[n] = value;
+    }
+    return table;
+}
+
+constexpr std::array<unsigned char, 16> MakeSyndromeFix() {
+    std::array<unsigned char, 16> table{};
+    table[3] = 0x1;
+    table[5] = 0x2;
+    table[6] = 0x4;
+    table[7] = 0x8;
+    return table;
+}
+
+alignas(16) constexpr std::array<unsigned char, 16> kEncodeNibble = MakeEncodeNibble();
+alignas(16) constexpr std::array<unsigned char, 16> kDecodeLow = MakeDecodeNibble(0);
+alignas(16) constexpr std::array<unsigned char, 16> kDecodeHigh = MakeDecodeNibble(4);
+alignas(16) constexpr std::array<unsigned char, 16> kSyndromeFix = MakeSyndromeFix();
+
+// Moves the first byte of every pair into the low half of each 128-bit lane
+// and the second byte into the high half.
+alignas(16) constexpr unsigned char kSplitPairs[16] = {
+    0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15
+};
+
+#ifdef HAMMING_X86_KERNELS
+
+__attribute__((target("sse4.1")))
+inline __m128i DecodeCodes(__m128i code, __m128i dec_low, __m128i dec_high,
+                           __m128i low_mask, __m128i syndrome_mask, __m128i& syndrome) {
+    __m128i value = _mm_xor_si128(
+        _mm_shuffle_epi8(dec_low, _mm_and_si128(code, low_mask)),
+        _mm_shuffle_epi8(dec_high, _mm_and_si128(_mm_srli_epi16(code, 4), low_mask)));
+    syndrome = _mm_and_si128(_mm_srli_epi16(value, 4), syndrome_mask);
+    return value;
+}
+
+__attribute__((target("avx2")))
+inline __m256i Broadcast256(const unsigned char* table) {
+    return _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(table)));
+}
+
+__attribute__((target("avx2")))
+inline __m256i DecodeCodes(__m256i code, __m256i dec_low, __m256i dec_high,
+                           __m256i low_mask, __m256i syndrome_mask, __m256i& syndrome) {
+    __m256i value = _mm256_xor_si256(
+        _mm256_shuffle_epi8(dec_low, _mm256_and_si256(code, low_mask)),
+        _mm256_shuffle_epi8(dec_high, _mm256_and_si256(_mm256_srli_epi16(code, 4), low_mask)));
+    syndrome = _mm256_and_si256(_mm256_srli_epi16(value, 4), syndrome_mask);
+    return value;
+}
+
+// The tables repeated into all four 128-bit lanes, so AVX-512 loads them
+// whole instead of broadcasting one lane.
+constexpr std::array<unsigned char, 64> RepeatToLanes(const unsigned char* table) {
+    std::array<unsigned char, 64> repeated{};
+    for (size_t i = 0; i < repeated.size(); i++)
+        repeated[i] = table[i % 16];
+    return repeated;
+}
+
+alignas(64) constexpr std::array<unsigned char, 64> kEncodeNibble512 = RepeatToLanes(kEncodeNibble.data());
+alignas(64) constexpr std::array<unsigned char, 64> kDecodeLow512 = RepeatToLanes(kDecodeLow.data());
+alignas(64) constexpr std::array<unsigned char, 64> kDecodeHigh512 = RepeatToLanes(kDecodeHigh.data());
+alignas(64) constexpr std::array<unsigned char, 64> kSyndromeFix512 = RepeatToLanes(kSyndromeFix.data());
+alignas(64) constexpr std::array<unsigned char, 64> kSplitPairs512 = RepeatToLanes(kSplitPairs);
+
+__attribute__((target("avx512f,avx512bw")))
+inline __m512i DecodeCodes(__m512i code, __m512i dec_low, __m512i dec_high,
+                           __m512i low_mask, __m512i syndrome_mask, __m512i& syndrome) {
+    __m512i value = _mm512_xor_si512(
+        _mm512_shuffle_epi8(dec_low, _mm512_and_si512(code, low_mask)),
+        _mm512_shuffle_epi8(dec_high, _mm512_and_si512(_mm512_srli_epi16(code, 4), low_mask)));
+    syndrome = _mm512_and_si512(_mm512_srli_epi16(value, 4), syndrome_mask);
+    return value;
+}
+
+#endif
+
+} // namespace
+
+namespace hammingcoder::simd {
+
+#ifdef HAMMING_X86_KERNELS
+
+bool CpuHasSse41() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.1");
+}
+
+bool CpuHasAvx2() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+bool CpuHasAvx512() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+}
+
+__attribute__((target("sse4.1")))
+size_t EncodeSse41(const unsigned char* data, size_t size, unsigned char* out) {
+    const __m128i table = _mm_load_si128(reinterpret_cast<const __m128i*>(kEncodeNibble.data()));
+    const __m128i low_mask = _mm_set1_epi8(0x0F);
+
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        __m128i low = _mm_shuffle_epi8(table, _mm_and_si128(bytes, low_mask));
+        __m128i high = _mm_shuffle_epi8(table, _mm_and_si128(_mm_srli_epi16(bytes, 4), low_mask));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 2 * i), _mm_unpacklo_epi8(low, high));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 2 * i + 16), _mm_unpackhi_epi8(low, high));
+    }
+    return i;
+}
+
+__attribute__((target("sse4.1")))
+size_t DecodeSse41(const unsigned char* encoded, size_t pairs, unsigned char* out,
+                   size_t& correct, size_t& uncorrect) {
+    const __m128i dec_low = _mm_load_si128(reinterpret_cast<const __m128i*>(kDecodeLow.data()));
+    const __m128i dec_high = _mm_load_si128(reinterpret_cast<const __m128i*>(kDecodeHigh.data()));
+    const __m128i fix = _mm_load_si128(reinterpret_cast<const __m128i*>(kSyndromeFix.data()));
+    const __m128i split = _mm_load_si128(reinterpret_cast<const __m128i*>(kSplitPairs));
+    const __m128i low_mask = _mm_set1_epi8(0x0F);
+    const __m128i syndrome_mask = _mm_set1_epi8(0x07);
+    const __m128i zero = _mm_setzero_si128();
+
+    size_t i = 0;
+    for (; i + 16 <= pairs; i += 16) {
+        __m128i a = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(encoded + 2 * i)), split);
+        __m128i b = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(encoded + 2 * i + 16)), split);
+        __m128i first = _mm_unpacklo_epi64(a, b);
+        __m128i second = _mm_unpackhi_epi64(a, b);
+
+        __m128i syn_first, syn_second;
+        __m128i val_first = DecodeCodes(first, dec_low, dec_high, low_mask, syndrome_mask, syn_first);
+        __m128i val_second = DecodeCodes(second, dec_low, dec_high, low_mask, syndrome_mask, syn_second);
+
+        __m128i nib_first = _mm_xor_si128(_mm_and_si128(val_first, low_mask), _mm_shuffle_epi8(fix, syn_first));
+        __m128i nib_second = _mm_xor_si128(_mm_and_si128(val_second, low_mask), _mm_shuffle_epi8(fix, syn_second));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i),
+                         _mm_or_si128(nib_first, _mm_slli_epi16(nib_second, 4)));
+
+        unsigned syn_first_set = ~_mm_movemask_epi8(_mm_cmpeq_epi8(syn_first, zero)) & 0xFFFFu;
+        unsigned syn_second_set = ~_mm_movemask_epi8(_mm_cmpeq_epi8(syn_second, zero)) & 0xFFFFu;
+        unsigned odd_first = _mm_movemask_epi8(val_first);
+        unsigned odd_second = _mm_movemask_epi8(val_second);
+        unsigned broken = (syn_first_set & ~odd_first) | (syn_second_set & ~odd_second);
+        correct += __builtin_popcount((odd_first | odd_second) & ~broken);
+        uncorrect += __builtin_popcount(broken);
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+size_t EncodeAvx2(const unsigned char* data, size_t size, unsigned char* out) {
+    const __m256i table = Broadcast256(kEncodeNibble.data());
+    const __m256i low_mask = _mm256_set1_epi8(0x0F);
+
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        __m256i low = _mm256_shuffle_epi8(table, _mm256_and_si256(bytes, low_mask));
+        __m256i high = _mm256_shuffle_epi8(table, _mm256_and_si256(_mm256_srli_epi16(bytes, 4), low_mask));
+        __m256i lo_pairs = _mm256_unpacklo_epi8(low, high);
+        __m256i hi_pairs = _mm256_unpackhi_epi8(low, high);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 2 * i),
+                            _mm256_permute2x128_si256(lo_pairs, hi_pairs, 0x20));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 2 * i + 32),
+                            _mm256_permute2x128_si256(lo_pairs, hi_pairs, 0x31));
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+size_t DecodeAvx2(const unsigned char* encoded, size_t pairs, unsigned char* out,
+                  size_t& correct, size_t& uncorrect) {
+    const __m256i dec_low = Broadcast256(kDecodeLow.data());
+    const __m256i dec_high = Broadcast256(kDecodeHigh.data());
+    const __m256i fix = Broadcast256(kSyndromeFix.data());
+    const __m256i split = Broadcast256(kSplitPairs);
+    const __m256i low_mask = _mm256_set1_epi8(0x0F);
+    const __m256i syndrome_mask = _mm256_set1_epi8(0x07);
+    const __m256i zero = _mm256_setzero_si256();
+
+    size_t i = 0;
+    for (; i + 32 <= pairs; i += 32) {
+        __m256i a = _mm256_shuffle_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(encoded + 2 * i)), split);
+        __m256i b = _mm256_shuffle_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(encoded + 2 * i + 32)), split);
+        __m256i first = _mm256_permute4x64_epi64(_mm256_unpacklo_epi64(a, b), 0xD8);
+        __m256i second = _mm256_permute4x64_epi64(_mm256_unpackhi_epi64(a, b), 0xD8);
+
+        __m256i syn_first, syn_second;
+        __m256i val_first = DecodeCodes(first, dec_low, dec_high, low_mask, syndrome_mask, syn_first);
+        __m256i val_second = DecodeCodes(second, dec_low, dec_high, low_mask, syndrome_mask, syn_second);
+
+        __m256i nib_first = _mm256_xor_si256(_mm256_and_si256(val_first, low_mask), _mm256_shuffle_epi8(fix, syn_first));
+        __m256i nib_second = _mm256_xor_si256(_mm256_and_si256(val_second, low_mask), _mm256_shuffle_epi8(fix, syn_second));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i),
+                            _mm256_or_si256(nib_first, _mm256_slli_epi16(nib_second, 4)));
+
+        unsigned syn_first_set = ~_mm256_movemask_epi8(_mm256_cmpeq_epi8(syn_first, zero));
+        unsigned syn_second_set = ~_mm256_movemask_epi8(_mm256_cmpeq_epi8(syn_second, zero));
+        unsigned odd_first = _mm256_movemask_epi8(val_first);
+        unsigned odd_second = _mm256_movemask_epi8(val_second);
+        unsigned broken = (syn_first_set & ~odd_first) | (syn_second_set & ~odd_second);
+        correct += __builtin_popcount((odd_first | odd_second) & ~broken);
+        uncorrect += __builtin_popcount(broken);
+    }
+    return i;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+size_t EncodeAvx512(const unsigned char* data, size_t size, unsigned char* out) {
+    const __m512i table = _mm512_loadu_si512(kEncodeNibble512.data());
+    const __m512i low_mask = _mm512_set1_epi8(0x0F);
+    const __m512i first_half = _mm512_setr_epi64(0, 1, 8, 9, 2, 3, 10, 11);
+    const __m512i second_half = _mm512_setr_epi64(4, 5, 12, 13, 6, 7, 14, 15);
+
+    size_t i = 0;
+    for (; i + 64 <= size; i += 64) {
+        __m512i bytes = _mm512_loadu_si512(data + i);
+        __m512i low = _mm512_shuffle_epi8(table, _mm512_and_si512(bytes, low_mask));
+        __m512i high = _mm512_shuffle_epi8(table, _mm512_and_si512(_mm512_srli_epi16(bytes, 4), low_mask));
+        __m512i lo_pairs = _mm512_unpacklo_epi8(low, high);
+        __m512i hi_pairs = _mm512_unpackhi_epi8(low, high);
+        _mm512_storeu_si512(out + 2 * i, _mm512_permutex2var_epi64(lo_pairs, first_half, hi_pairs));
+        _mm512_storeu_si512(out + 2 * i + 64, _mm512_permutex2var_epi64(lo_pairs, second_half, hi_pairs));
+    }
+    return i;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+size_t DecodeAvx512(const unsigned char* encoded, size_t pairs, unsigned char* out,
+                    size_t& correct, size_t& uncorrect) {
+    const __m512i dec_low = _mm512_loadu_si512(kDecodeLow512.data());
+    const __m512i dec_high = _mm512_loadu_si512(kDecodeHigh512.data());
+    const __m512i fix = _mm512_loadu_si512(kSyndromeFix512.data());
+    const __m512i split = _mm512_loadu_si512(kSplitPairs512.data());
+    const __m512i low_mask = _mm512_set1_epi8(0x0F);
+    const __m512i syndrome_mask = _mm512_set1_epi8(0x07);
+    const __m512i even_qwords = _mm512_setr_epi64(0, 2, 4, 6, 8, 10, 12, 14);
+    const __m512i odd_qwords = _mm512_setr_epi64(1, 3, 5, 7, 9, 11, 13, 15);
+
+    size_t i = 0;
+    for (; i + 64 <= pairs; i += 64) {
+        __m512i a = _mm512_shuffle_epi8(_mm512_loadu_si512(encoded + 2 * i), split);
+        __m512i b = _mm512_shuffle_epi8(_mm512_loadu_si512(encoded + 2 * i + 64), split);
+        __m512i first = _mm512_permutex2var_epi64(a, even_qwords, b);
+        __m512i second = _mm512_permutex2var_epi64(a, odd_qwords, b);
+
+        __m512i syn_first, syn_second;
+        __m512i val_first = DecodeCodes(first, dec_low, dec_high, low_mask, syndrome_mask, syn_first);
+        __m512i val_second = DecodeCodes(second, dec_low, dec_high, low_mask, syndrome_mask, syn_second);
+
+        __m512i nib_first = _mm512_xor_si512(_mm512_and_si512(val_first, low_mask), _mm512_shuffle_epi8(fix, syn_first));
+        __m512i nib_second = _mm512_xor_si512(_mm512_and_si512(val_second, low_mask), _mm512_shuffle_epi8(fix, syn_second));
+        _mm512_storeu_si512(out + i, _mm512_or_si512(nib_first, _mm512_slli_epi16(nib_second, 4)));
+
+        uint64_t syn_first_set = _mm512_test_epi8_mask(syn_first, syn_first);
+        uint64_t syn_second_set = _mm512_test_epi8_mask(syn_second, syn_second);
+        uint64_t odd_first = _mm512_movepi8_mask(val_first);
+        uint64_t odd_second = _mm512_movepi8_mask(val_second);
+        uint64_t broken = (syn_first_set & ~odd_first) | (syn_second_set & ~odd_second);
+        correct += __builtin_popcountll((odd_first | odd_second) & ~broken);
+        uncorrect += __builtin_popcountll(broken);
+    }
+    return i;
+}
+
+#else
+
+bool CpuHasSse41() { return false; }
+bool CpuHasAvx2() { return false; }
+bool CpuHasAvx512() { return false; }
+
+size_t EncodeSse41(const unsigned char*, size_t, unsigned char*) { return 0; }
+size_t DecodeSse41(const unsigned char*, size_t, unsigned char*, size_t&, size_t&) { return 0; }
+size_t EncodeAvx2(const unsigned char*, size_t, unsigned char*) { return 0; }
+size_t DecodeAvx2(const unsigned char*, size_t, unsigned char*, size_t&, size_t&) { return 0; }
+size_t EncodeAvx512(const unsigned char*, size_t, unsigned char*) { return 0; }
+size_t DecodeAvx512(const unsigned char*, size_t, unsigned char*, size_t&, size_t&) { return 0; }
+
+#endif
+
+} // namespace hammingcoder::simd
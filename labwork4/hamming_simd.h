@@ -0,0 +1,30 @@
+#ifndef HAMMING_SIMD_H
+#define HAMMING_SIMD_H
+
+#include <cstddef>
+
+namespace hammingcoder::simd {
+
+// Kernels handle whole vectors only and return how many input bytes (encode)
+// or code pairs (decode) they consumed; the caller finishes the tail.
+using EncodeKernel = size_t (*)(const unsigned char* data, size_t size, unsigned char* out);
+using DecodeKernel = size_t (*)(const unsigned char* encoded, size_t pairs, unsigned char* out,
+                                size_t& correct, size_t& uncorrect);
+
+bool CpuHasSse41();
+bool CpuHasAvx2();
+bool CpuHasAvx512();
+
+size_t EncodeSse41(const unsigned char* data, size_t size, unsigned char* out);
+size_t DecodeSse41(const unsigned char* encoded, size_t pairs, unsigned char* out,
+                   size_t& correct, size_t& uncorrect);
+size_t EncodeAvx2(const unsigned char* data, size_t size, unsigned char* out);
+size_t DecodeAvx2(const unsigned char* encoded, size_t pairs, unsigned char* out,
+                  size_t& correct, size_t& uncorrect);
+size_t EncodeAvx512(const unsigned char* data, size_t size, unsigned char* out);
+size_t DecodeAvx512(const unsigned char* encoded, size_t pairs, unsigned char* out,
+                    size_t& correct, size_t& uncorrect);
+
+} // namespace hammingcoder::simd
+
+#endif
@@ -0,0 +1,90 @@
+#include "hamming.h"
+#include <array>
+#include <cstring>
+
+namespace {
+
+// Bit-matrix transpose of eight bytes: bit j of byte i becomes bit i of
+// byte j. Three rounds of masked swaps instead of 64 single-bit moves.
+inline uint64_t Transpose8x8(uint64_t x) {
+    uint64_t t;
+    t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAull;
+    x ^= t ^ (t << 7);
+    t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCull;
+    x ^= t ^ (t << 14);
+    t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ull;
+    x ^= t ^ (t << 28);
+    return x;
+}
+
+constexpr size_t kMaxGroupBytes = 64 * 9;
+
+// Within a group of `depth` codewords, bit b of codeword k is stored at bit
+// position b * depth + k. Eight codewords at a time, byte j of each forms an
+// 8x8 bit matrix whose transpose gives the eight output bytes for codeword
+// bits 8j..8j+7.
+void InterleaveGroup(std::byte* group, size_t codeword_size, unsigned depth) {
+    std::array<std::byte, kMaxGroupBytes> source;
+    std::memcpy(source.data(), group, depth * codeword_size);
+
+    const size_t columns = depth / 8;
+    for (size_t j = 0; j < codeword_size; j++) {
+        for (size_t g = 0; g < columns; g++) {
+            uint64_t rows = 0;
+            for (size_t r = 0; r < 8; r++)
+                rows |= static_cast<uint64_t>(source[(8 * g + r) * codeword_size + j]) << (8 * r);
+            uint64_t bits = Transpose8x8(rows);
+            for (size_t b = 0; b < 8; b++)
+                group[(8 * j + b) * columns + g] = static_cast<std::byte>(bits >> (8 * b));
+        }
+    }
+}
+
+void DeinterleaveGroup(std::byte* group, size_t codeword_size, unsigned depth) {
+    std::array<std::byte, kMaxGroupBytes> source;
+    std::memcpy(source.data(), group, depth * codeword_size);
+
+    const size_t columns = depth / 8;
+    for (size_t j = 0; j < codeword_size; j++) {
+        for (size_t g = 0; g < columns; g++) {
+            uint64_t rows = 0;
+            for (size_t b = 0; b < 8; b++)
+                rows |= static_cast<uint64_t>(source[(8 * j + b) * columns + g]) << (8 * b);
+            uint64_t bits = Transpose8x8(rows);
+            for (size_t r = 0; r < 8; r++)
+                group[(8 * g + r) * codeword_size + j] = static_cast<std::byte>(bits >> (8 * r));
+        }
+    }
+}
+
+} // namespace
+
+namespace hammingcoder {
+
+bool IsValidInterleave(unsigned depth) {
+    return depth == 0 || depth == 8 || depth == 16 || depth == 32 || depth == 64;
+}
+
+size_t InterleaveGroupSize(const Codec& codec, unsigned depth) {
+    return depth == 0 ? codec.CodeUnit() : depth * codec.CodewordSize();
+}
+
+void Interleave(std::span<std::byte> encoded, size_t codeword_size, unsigned depth) {
+    const size_t group = depth * codeword_size;
+    if (depth == 0 || group > kMaxGroupBytes) {
+        return;
+    }
+    for (size_t i = 0; i + group <= encoded.size(); i += group)
+        InterleaveGroup(encoded.data() + i, codeword_size, depth);
+}
+
+void Deinterleave(std::span<std::byte> encoded, size_t codeword_size, unsigned depth) {
+    const size_t group = depth * codeword_size;
+    if (depth == 0 || group > kMaxGroupBytes) {
+        return;
+    }
+    for (size_t i = 0; i + group <= encoded.size(); i += group)
+        DeinterleaveGroup(encoded.data() + i, codeword_size, depth);
+}
+
+} // namespace hammingcoder
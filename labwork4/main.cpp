@@ -2,11 +2,54 @@
 #include <vector>
 #include <string>
 #include <cstddef>
+#include <cerrno>
+#include <cstdlib>
+#include <cstdio>
+#include <iostream>
+
+void RenderProgress(const std::string& filename, const hammingcoder::StreamProgress& progress){
+	const double mb = 1024.0 * 1024.0;
+	if (progress.bytes_total != 0){
+		std::fprintf(stderr, "\r%s: %5.1f%%", filename.c_str(), 100.0 * progress.bytes_done / progress.bytes_total);
+	} else{
+		std::fprintf(stderr, "\r%s: %.1f MB", filename.c_str(), progress.bytes_done / mb);
+	}
+	std::fprintf(stderr, "  %.1f MB/s", progress.bytes_per_second / mb);
+	if (progress.corrected != 0 || progress.uncorrectable != 0){
+		std::fprintf(stderr, "  corrected %llu, uncorrectable %llu",
+			static_cast<unsigned long long>(progress.corrected),
+			static_cast<unsigned long long>(progress.uncorrectable));
+	}
+	std::fprintf(stderr, progress.finished ? "\n" : "   ");
+	std::fflush(stderr);
+}
+
+// Parses START:END, where either side may be left out, into [start, end).
+bool ParseRange(const std::string& range, unsigned long long& start, unsigned long long& end){
+	size_t colon = range.find(':');
+	std::string first = range.substr(0, colon);
+	std::string second = colon == std::string::npos ? std::string() : range.substr(colon + 1);
+	if (first.find_first_not_of("0123456789") != std::string::npos ||
+		second.find_first_not_of("0123456789") != std::string::npos){
+		return false;
+	}
+	errno = 0;
+	start = first.empty() ? 0 : std::strtoull(first.c_str(), nullptr, 10);
+	end = second.empty() ? ~0ULL : std::strtoull(second.c_str(), nullptr, 10);
+	return errno != ERANGE && start <= end;
+}
+
 int main(int argc, char* argv[]) {
 	
 
 	std::vector<std::string> args(argv+1, argv+argc);
 	std::string archive_path;
+	std::string codec_name = "hamming84";
+	std::string interleave = "0";
+	std::string threads = "0";
+	std::string compression = "none";
+	std::string range;
+	bool show_progress = false;
 	std::vector<std::string> files;
 	for (size_t i = 0; i < args.size(); i++){
 		if (args[i] == "-f" || args[i] == "--file"){
@@ -18,21 +61,94 @@ int main(int argc, char* argv[]) {
 			archive_path = args[i].substr(std::string("--file=").size());
 
 		} 
+		else if (args[i] == "--codec"){
+			if (i + 1 < args.size()){
+				codec_name = args[++i];
+			}
+		}
+		else if (args[i].find("--codec=") == 0){
+			codec_name = args[i].substr(std::string("--codec=").size());
+		}
+		else if (args[i] == "--interleave"){
+			if (i + 1 < args.size()){
+				interleave = args[++i];
+			}
+		}
+		else if (args[i].find("--interleave=") == 0){
+			interleave = args[i].substr(std::string("--interleave=").size());
+		}
+		else if (args[i] == "--threads"){
+			if (i + 1 < args.size()){
+				threads = args[++i];
+			}
+		}
+		else if (args[i].find("--threads=") == 0){
+			threads = args[i].substr(std::string("--threads=").size());
+		}
+		else if (args[i] == "--compress"){
+			if (i + 1 < args.size()){
+				compression = args[++i];
+			}
+		}
+		else if (args[i].find("--compress=") == 0){
+			compression = args[i].substr(std::string("--compress=").size());
+		}
+		else if (args[i] == "--range"){
+			if (i + 1 < args.size()){
+				range = args[++i];
+			}
+		}
+		else if (args[i].find("--range=") == 0){
+			range = args[i].substr(std::string("--range=").size());
+		}
+		else if (args[i] == "--progress"){
+			show_progress = true;
+		}
 		else if (args[i] != "-c" && args[i] != "-l" && args[i] != "-x" && 
                 args[i] != "-a" && args[i] != "-d" && args[i] != "-A" &&
                 args[i] != "--create" && args[i] != "--list" && args[i] != "--extract" &&
-                args[i] != "--append" && args[i] != "--delete" && args[i] != "--concatenate"){
+                args[i] != "--append" && args[i] != "--delete" && args[i] != "--concatenate" &&
+                args[i] != "-s" && args[i] != "--scrub" && args[i] != "--compact" && args[i] != "--verify"){
 					files.push_back(args[i]);
 				   }
 	}
 	
 	hamarc::ArchiveState state;
 	state.archivePath = archive_path;
+	if (show_progress){
+		state.progress = RenderProgress;
+	}
 
 	std::string command = args[0];
 	if (command == "-c" || command == "--create"){
-		
-		hamarc::CreateArchive(archive_path, files);
+		const hammingcoder::Codec* codec = hammingcoder::FindCodec(codec_name);
+		if (!codec){
+			std::cerr << "Unknown codec: " << codec_name << " (expected hamming84 or secded72)" << std::endl;
+			return 1;
+		}
+		hamarc::CreateOptions options;
+		options.codec = codec->Id();
+		options.interleave = static_cast<unsigned>(std::strtoul(interleave.c_str(), nullptr, 10));
+		options.progress = state.progress;
+		options.threads = static_cast<unsigned>(std::strtoul(threads.c_str(), nullptr, 10));
+		if (!hammingcoder::IsValidInterleave(options.interleave)){
+			std::cerr << "Invalid interleave depth: " << interleave << " (expected 0, 8, 16, 32 or 64)" << std::endl;
+			return 1;
+		}
+		if (compression == "deflate"){
+			options.compression = hamarc::kCompressionDeflate;
+		} else if (compression != "none"){
+			std::cerr << "Unknown compression: " << compression << " (expected none or deflate)" << std::endl;
+			return 1;
+		}
+		if (!hamarc::IsCompressionAvailable(options.compression)){
+			std::cerr << "hamarc was built without zlib; --compress deflate is unavailable" << std::endl;
+			return 1;
+		}
+		if (!hamarc::CreateArchive(archive_path, files, options)){
+			std::cerr << "Cannot create archive: " << archive_path << std::endl;
+			return 1;
+		}
 	}
 	else if (command == "-l" || command == "--list"){
 		if (hamarc::LoadArchive(state)){
@@ -40,12 +156,28 @@ int main(int argc, char* argv[]) {
 		}
 	}
 	else if (command == "-x" || command == "--extract"){
-		if (!hamarc::LoadArchive(state)){
+		unsigned long long start = 0, end = 0;
+		if (!range.empty() && !ParseRange(range, start, end)){
+			std::cerr << "Invalid range: " << range << " (expected START:END with START <= END)" << std::endl;
+			return 1;
+		}
+		if (!range.empty() && files.empty()){
+			std::cerr << "--range needs the members to extract from" << std::endl;
+			return 1;
+		}
+		if (!(files.empty() ? hamarc::LoadArchive(state) : hamarc::OpenArchive(state))){
 			return 1;
 		}
 		if (files.empty()){
-			hamarc::ExtractAll(state, std::string(""));
-
+			if (!hamarc::ExtractAll(state, std::string(""), static_cast<unsigned>(std::strtoul(threads.c_str(), nullptr, 10)))){
+				return 1;
+			}
+		} else if (!range.empty()){
+			for (const auto& file : files){
+				if (!hamarc::ExtractRange(state, file, start, end, std::string("out"))){
+					return 1;
+				}
+			}
 		} else{
 			for (const auto& file : files){
 				hamarc::ExtractFile(state, file, std::string("out"));
@@ -71,5 +203,35 @@ int main(int argc, char* argv[]) {
 		
 		hamarc::ConcatenateArchives(files[0], files[1], archive_path);
 	}
+	else if (command == "--compact"){
+		if (!hamarc::LoadArchive(state) || !hamarc::CompactArchive(state)){
+			std::cerr << "Compaction failed: " << archive_path << std::endl;
+			return 1;
+		}
+	}
+	else if (command == "-s" || command == "--scrub"){
+		if (!hamarc::LoadArchive(state)){
+			return 1;
+		}
+		hamarc::ScrubReport report;
+		if (!hamarc::ScrubArchive(state, report)){
+			std::cerr << "Scrub failed: " << archive_path << std::endl;
+			return 1;
+		}
+		hamarc::PrintScrubReport(report);
+		return report.decode.uncorrectable == 0 ? 0 : 1;
+	}
+	else if (command == "--verify"){
+		if (!hamarc::LoadArchive(state)){
+			return 1;
+		}
+		hamarc::VerifyReport report;
+		if (!hamarc::VerifyArchive(state, report, static_cast<unsigned>(std::strtoul(threads.c_str(), nullptr, 10)))){
+			std::cerr << "Verify failed: " << archive_path << std::endl;
+			return 1;
+		}
+		hamarc::PrintVerifyReport(report);
+		return report.failed.empty() ? 0 : 1;
+	}
 	return 0;
 }
@@ -0,0 +1,147 @@
+#include "secded.h"
+#include <array>
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+namespace {
+
+// Extended Hamming(72,64). The 64 data bits take the non-power-of-two
+// positions 3..71 of a Hamming(71,64) code; the check byte stores the seven
+// check bits (positions 1, 2, 4, ..., 64) in bits 0-6 and the parity of the
+// whole 72-bit codeword in bit 7. Every check bit is the parity of one
+// 64-bit mask, so a word costs a handful of popcounts.
+
+constexpr size_t kWordBytes = 8;
+constexpr size_t kCodewordBytes = 9;
+
+constexpr bool IsPowerOfTwo(unsigned value) {
+    return value != 0 && (value & (value - 1)) == 0;
+}
+
+constexpr std::array<unsigned, 64> MakeDataPositions() {
+    std::array<unsigned, 64> positions{};
+    unsigned next = 0;
+    for (unsigned pos = 1; next < 64; pos++) {
+        if (!IsPowerOfTwo(pos))
+            positions[next++] = pos;
+    }
+    return positions;
+}
+
+constexpr std::array<unsigned, 64> kDataPositions = MakeDataPositions();
+
+constexpr std::array<uint64_t, 7> MakeCheckMasks() {
+    std::array<uint64_t, 7> masks{};
+    for (unsigned bit = 0; bit < 64; bit++) {
+        for (unsigned k = 0; k < 7; k++) {
+            if (kDataPositions[bit] & (1u << k))
+                masks[k] |= uint64_t{1} << bit;
+        }
+    }
+    return masks;
+}
+
+// Data bit index for every syndrome, -1 where the syndrome names a check bit
+// or lies outside the 71 used positions.
+constexpr std::array<int, 128> MakeSyndromeToBit() {
+    std::array<int, 128> table{};
+    for (auto& entry : table)
+        entry = -1;
+    for (unsigned bit = 0; bit < 64; bit++)
+        table[kDataPositions[bit]] = static_cast<int>(bit);
+    return table;
+}
+
+constexpr std::array<uint64_t, 7> kCheckMasks = MakeCheckMasks();
+constexpr std::array<int, 128> kSyndromeToBit = MakeSyndromeToBit();
+
+inline unsigned CheckBits(uint64_t word) {
+    unsigned check = 0;
+    for (unsigned k = 0; k < 7; k++)
+        check |= (std::popcount(word & kCheckMasks[k]) & 1u) << k;
+    return check;
+}
+
+inline unsigned char EncodeWord(uint64_t word) {
+    unsigned check = CheckBits(word);
+    unsigned parity = (std::popcount(word) + std::popcount(check)) & 1u;
+    return static_cast<unsigned char>(check | (parity << 7));
+}
+
+class Secded7264 : public hammingcoder::Codec {
+public:
+    hammingcoder::CodecId Id() const override { return hammingcoder::kCodecSecded7264; }
+    const char* Name() const override { return "secded72"; }
+    size_t DataUnit() const override { return kWordBytes; }
+    size_t CodeUnit() const override { return kCodewordBytes; }
+    size_t CodewordSize() const override { return kCodewordBytes; }
+
+    size_t EncodeInto(std::span<const std::byte> in, std::span<std::byte> out) const override {
+        size_t words = (in.size() + kWordBytes - 1) / kWordBytes;
+        if (out.size() < words * kCodewordBytes) {
+            return 0;
+        }
+
+        for (size_t i = 0; i < words; i++) {
+            uint64_t word = 0;
+            size_t take = std::min(kWordBytes, in.size() - i * kWordBytes);
+            std::memcpy(&word, in.data() + i * kWordBytes, take);
+
+            std::byte* code = out.data() + i * kCodewordBytes;
+            std::memcpy(code, &word, kWordBytes);
+            code[kWordBytes] = static_cast<std::byte>(EncodeWord(word));
+        }
+        return words * kCodewordBytes;
+    }
+
+    size_t DecodeInto(std::span<const std::byte> in, std::span<std::byte> out, hammingcoder::DecodeReport& report,
+                      uint64_t stream_offset) const override {
+        size_t words = in.size() / kCodewordBytes;
+        if (out.size() < words * kWordBytes) {
+            return 0;
+        }
+
+        for (size_t i = 0; i < words; i++) {
+            const std::byte* code = in.data() + i * kCodewordBytes;
+            uint64_t word;
+            std::memcpy(&word, code, kWordBytes);
+            unsigned stored = static_cast<unsigned char>(code[kWordBytes]);
+
+            unsigned syndrome = CheckBits(word) ^ (stored & 0x7F);
+            bool odd = ((std::popcount(word) + std::popcount(stored)) & 1u) != 0;
+
+            if (odd) {
+                if (syndrome != 0 && !IsPowerOfTwo(syndrome)) {
+                    int bit = kSyndromeToBit[syndrome];
+                    if (bit < 0) {
+                        report.uncorrectable++;
+                        report.AddDamage(stream_offset + i * kCodewordBytes, kCodewordBytes);
+                    } else {
+                        word ^= uint64_t{1} << bit;
+                        report.corrected++;
+                    }
+                } else {
+                    report.corrected++;
+                }
+            } else if (syndrome != 0) {
+                report.uncorrectable++;
+                report.AddDamage(stream_offset + i * kCodewordBytes, kCodewordBytes);
+            }
+
+            std::memcpy(out.data() + i * kWordBytes, &word, kWordBytes);
+        }
+        return words * kWordBytes;
+    }
+};
+
+} // namespace
+
+namespace hammingcoder {
+
+const Codec& Secded7264Codec() {
+    static const Secded7264 codec;
+    return codec;
+}
+
+} // namespace hammingcoder
@@ -0,0 +1,10 @@
+#ifndef SECDED_H
+#define SECDED_H
+
+#include "hamming.h"
+
+namespace hammingcoder {
+    const Codec& Secded7264Codec();
+}
+
+#endif
@@ -1,7 +1,9 @@
 #include <gtest/gtest.h>
+#include <algorithm>
 #include <chrono>
 #include <filesystem>
 #include <fstream>
+#include <functional>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -9,7 +11,15 @@
 #include <cstdint>
 #include <cstring>
 #include <iostream>
+#include <map>
+#include <random>
+#include <span>
 #include <utility>
+#include "hamarc.h"
+#include "checksum.h"
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
 namespace fs = std::filesystem;
 
 static std::string QuotePath(const fs::path& p) {
@@ -48,6 +58,112 @@ static bool FilesEqual(const fs::path& a, const fs::path& b) {
 	return fa.eof() && fb.eof();
 }
 
+static std::vector<char> RandomData(std::size_t size, unsigned seed) {
+	std::mt19937 rng(seed);
+	std::uniform_int_distribution<int> dist(0, 255);
+	std::vector<char> data(size);
+	for (auto& c : data) c = static_cast<char>(dist(rng));
+	return data;
+}
+
+static void WriteBytes(const fs::path& path, const std::vector<char>& data) {
+	std::ofstream file(path, std::ios::binary);
+	file.write(data.data(), static_cast<std::streamsize>(data.size()));
+}
+
+static std::vector<char> ReadBytes(const fs::path& path) {
+	std::ifstream file(path, std::ios::binary);
+	return std::vector<char>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+static void FlipBit(const fs::path& path, std::uintmax_t byte_pos, int bit_pos) {
+	std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+	file.seekg(static_cast<std::streamoff>(byte_pos));
+	char byte = 0;
+	file.read(&byte, 1);
+	byte ^= static_cast<char>(1 << bit_pos);
+	file.seekp(static_cast<std::streamoff>(byte_pos));
+	file.write(&byte, 1);
+}
+
+// Runs hamarc with `args` from `cwd` (the current directory when empty)
+// and returns its exit status.
+static int RunHamArc(const std::vector<std::string>& args, const fs::path& cwd = {}) {
+	std::ostringstream cmd;
+	cmd << QuotePath(HAMARC_EXE_PATH);
+	for (const auto& arg : args) {
+		cmd << " " << QuotePath(arg);
+	}
+	const fs::path original_dir = fs::current_path();
+	if (!cwd.empty()) {
+		fs::current_path(cwd);
+	}
+	const int rc = std::system(cmd.str().c_str());
+	fs::current_path(original_dir);
+	return rc;
+}
+
+// The resource files are not part of the repository; a checkout without
+// them gets pseudo-random stand-ins of a similar size. CTest runs every
+// test in its own process, possibly several at once, so a stand-in is
+// written under a name of its own and renamed into place whole.
+class ResourceFiles : public testing::Environment {
+public:
+	void SetUp() override {
+		const fs::path dir(RESOURCES_DIR);
+		fs::create_directories(dir);
+		Provide(dir / "BjarneStroustrup.jpg", 183 * 1024 + 17, 1);
+		Provide(dir / "Book.pdf", 3 * 1024 * 1024 + 5, 2);
+	}
+
+private:
+	static void Provide(const fs::path& path, std::size_t size, unsigned seed) {
+		if (fs::exists(path)) {
+			return;
+		}
+		fs::path temp = path;
+		temp += ".tmp" + std::to_string(std::random_device()()) +
+		        std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
+		WriteBytes(temp, RandomData(size, seed));
+		fs::rename(temp, path);
+	}
+};
+
+static testing::Environment* const kResourceFiles = testing::AddGlobalTestEnvironment(new ResourceFiles);
+
+// Gives each test its own scratch directory under the system temp dir.
+class HamArcTest : public testing::Test {
+protected:
+	void SetUp() override {
+		const auto now = std::chrono::steady_clock::now().time_since_epoch().count();
+		work_ = fs::temp_directory_path() / ("hamarc_test_" + std::to_string(now));
+		ASSERT_TRUE(fs::create_directories(work_ / "out"));
+		archive_ = work_ / "archive.haf";
+	}
+
+	void TearDown() override {
+		std::error_code ec;
+		fs::remove_all(work_, ec);
+	}
+
+	fs::path MakeFile(const std::string& name, const std::vector<char>& data) {
+		const fs::path path = work_ / name;
+		WriteBytes(path, data);
+		return path;
+	}
+
+	// Extracts every member into `out` and checks it against the inputs.
+	void ExpectExtractsTo(const std::vector<fs::path>& inputs) {
+		ASSERT_EQ(RunHamArc({"-x", "-f", archive_.string()}, work_ / "out"), 0);
+		for (const auto& input : inputs) {
+			EXPECT_TRUE(FilesEqual(input, work_ / "out" / input.filename())) << input.filename();
+		}
+	}
+
+	fs::path work_;
+	fs::path archive_;
+};
+
 TEST(HamArcCLI, CreateAndExtractAndCompare) {
 	const fs::path resources_dir = fs::path(RESOURCES_DIR);
 	const fs::path file1 = resources_dir / "BjarneStroustrup.jpg";
@@ -128,3 +244,1045 @@ TEST(HamArcCLI, CreateAndExtractAndCompare) {
 	EXPECT_TRUE(FilesEqual(file1, extr1));
 	EXPECT_TRUE(FilesEqual(file2, extr2));
 }
+
+TEST_F(HamArcTest, AppendStreamsLargeFilesIntoTheArchive) {
+	const fs::path first = MakeFile("first.bin", RandomData(300000, 11));
+	const fs::path second = MakeFile("second.bin", RandomData(5 * 1024 * 1024 + 3, 12));
+	const fs::path empty = MakeFile("empty.bin", {});
+	ASSERT_EQ(RunHamArc({"-c", "-f", archive_.string(), first.string()}), 0);
+	ASSERT_EQ(RunHamArc({"-a", "-f", archive_.string(), second.string(), empty.string()}), 0);
+
+	hamarc::ArchiveState state;
+	state.archivePath = archive_.string();
+	ASSERT_TRUE(hamarc::LoadArchive(state));
+	EXPECT_EQ(hamarc::ListFiles(state).size(), 3u);
+	ExpectExtractsTo({first, second, empty});
+}
+
+TEST_F(HamArcTest, AppendReplacesMemberOfTheSameName) {
+	const fs::path file = MakeFile("file.bin", RandomData(1000, 13));
+	ASSERT_EQ(RunHamArc({"-c", "-f", archive_.string(), file.string()}), 0);
+	WriteBytes(file, RandomData(2000, 14));
+	ASSERT_EQ(RunHamArc({"-a", "-f", archive_.string(), file.string()}), 0);
+
+	hamarc::ArchiveState state;
+	state.archivePath = archive_.string();
+	ASSERT_TRUE(hamarc::LoadArchive(state));
+	EXPECT_EQ(hamarc::ListFiles(state).size(), 1u);
+	ExpectExtractsTo({file});
+}
+
+TEST_F(HamArcTest, ScrubRestoresFlippedBitsInPlace) {
+	const fs::path file = MakeFile("file.bin", RandomData(200000, 21));
+	ASSERT_EQ(RunHamArc({"-c", "-f", archive_.string(), file.string()}), 0);
+	const std::vector<char> clean = ReadBytes(archive_);
+
+	FlipBit(archive_, 5, 0);
+	FlipBit(archive_, 1000, 3);
+	FlipBit(archive_, clean.size() / 2, 7);
+	FlipBit(archive_, clean.size() - 1, 6);
+	EXPECT_EQ(RunHamArc({"--scrub", "-f", archive_.string()}), 0);
+	EXPECT_EQ(ReadBytes(archive_), clean);
+	ExpectExtractsTo({file});
+}
+
+TEST_F(HamArcTest, ScrubLeavesUncorrectableCodewordsAlone) {
+	const fs::path file = MakeFile("file.bin", RandomData(200000, 22));
+	ASSERT_EQ(RunHamArc({"-c", "-f", archive_.string(), file.string()}), 0);
+	const std::uintmax_t size = fs::file_size(archive_);
+
+	FlipBit(archive_, size / 2, 0);
+	FlipBit(archive_, size / 2, 1);
+	FlipBit(archive_, size / 2 + 100, 2);
+	const std::vector<char> damaged = ReadBytes(archive_);
+
+	EXPECT_NE(RunHamArc({"--scrub", "-f", archive_.string()}), 0);
+	std::vector<char> scrubbed = ReadBytes(archive_);
+	ASSERT_EQ(scrubbed.size(), damaged.size());
+	EXPECT_EQ(scrubbed[size / 2], damaged[size / 2]);
+	EXPECT_NE(scrubbed[size / 2 + 100], damaged[size / 2 + 100]);
+	RunHamArc({"-x", "-f", archive_.string()}, work_ / "out");
+	EXPECT_FALSE(fs::exists(work_ / "out" / "file.bin"));
+}
+
+TEST_F(HamArcTest, ExtractFileStreamsMembersAcrossChunks) {
+	const fs::path small = MakeFile("small.bin", RandomData(10, 31));
+	const fs::path large = MakeFile("large.bin", RandomData(3 * (1 << 20) + 77, 32));
+	ASSERT_EQ(RunHamArc({"-c", "-f", archive_.string(), small.string(), large.string()}), 0);
+
+	hamarc::ArchiveState state;
+	state.archivePath = archive_.string();
+	ASSERT_TRUE(hamarc::LoadArchive(state));
+	ASSERT_TRUE(hamarc::ExtractFile(state, "large.bin", (work_ / "out" / "large.bin").string()));
+	ASSERT_TRUE(hamarc::ExtractFile(state, "small.bin", (work_ / "out" / "small.bin").string()));
+	EXPECT_TRUE(FilesEqual(large, work_ / "out" / "large.bin"));
+	EXPECT_TRUE(FilesEqual(small, work_ / "out" / "small.bin"));
+	EXPECT_FALSE(hamarc::ExtractFile(state, "missing.bin", (work_ / "out" / "missing.bin").string()));
+}
+
+TEST_F(HamArcTest, ExtractFileRemovesOutputOfDamagedMember) {
+	const fs::path file = MakeFile("file.bin", RandomData(3 * (1 << 20), 33));
+	ASSERT_EQ(RunHamArc({"-c", "-f", archive_.string(), file.string()}), 0);
+	const std::uintmax_t size = fs::file_size(archive_);
+	FlipBit(archive_, size - 1000, 0);
+	FlipBit(archive_, size - 1000, 1);
+
+	hamarc::ArchiveState state;
+	state.archivePath = archive_.string();
+	ASSERT_TRUE(hamarc::LoadArchive(state));
+	const fs::path output = work_ / "out" / "file.bin";
+	EXPECT_FALSE(hamarc::ExtractFile(state, "file.bin", output.string()));
+	EXPECT_FALSE(fs::exists(output));
+}
+
+TEST_F(HamArcTest, ReaderRangesStayInsideTheMapping) {
+	const fs::path file = MakeFile("file.bin", RandomData(5000, 41));
+	{
+		hamarc::ArchiveReader reader(file.string());
+		ASSERT_TRUE(reader.IsOpen());
+		EXPECT_EQ(reader.Size(), 5000u);
+		EXPECT_EQ(reader.Range(4000, 1000).size(), 1000u);
+		EXPECT_TRUE(reader.Range(4000, 1001).empty());
+		EXPECT_TRUE(reader.Range(~0ULL, 2).empty());
+	}
+	EXPECT_FALSE(hamarc::ArchiveReader((work_ / "missing").string()).IsOpen());
+}
+
+TEST_F(HamArcTest, LoadRejectsTruncatedAndForeignFiles) {
+	const fs::path file = MakeFile("file.bin", RandomData(5000, 42));
+	ASSERT_EQ(RunHamArc({"-c", "-f", archive_.string(), file.string()}), 0);
+
+	hamarc::ArchiveState state;
+	state.archivePath = file.string();
+	EXPECT_FALSE(hamarc::LoadArchive(state));
+	state.archivePath = MakeFile("empty.haf", {}).string();
+	EXPECT_FALSE(hamarc::LoadArchive(state));
+
+	std::vector<char> bytes = ReadBytes(archive_);
+	bytes.resize(20);
+	state.archivePath = MakeFile("short.haf", bytes).string();
+	EXPECT_FALSE(hamarc::LoadArchive(state));
+
+	state.archivePath = archive_.string();
+	ASSERT_TRUE(hamarc::LoadArchive(state));
+	EXPECT_EQ(hamarc::ListFiles(state), std::vector<std::string>{"file.bin"});
+}
+
+#ifndef _WIN32
+TEST_F(HamArcTest, ExtractAllOpensOutputsOnlyWhileMembersAreInFlight) {
+	std::vector<fs::path> inputs;
+	std::vector<std::string> paths;
+	for (int i = 0; i < 300; i++) {
+		inputs.push_back(MakeFile("member" + std::to_string(i) + ".bin", RandomData(1000 + i * 37, 100 + i)));
+		paths.push_back(inputs.back().string());
+	}
+	ASSERT_TRUE(hamarc::CreateArchive(archive_.string(), paths));
+
+	// hamarc inherits a descriptor limit well below the member count.
+	rlimit original;
+	ASSERT_EQ(getrlimit(RLIMIT_NOFILE, &original), 0);
+	rlimit lowered = original;
+	lowered.rlim_cur = 64;
+	ASSERT_EQ(setrlimit(RLIMIT_NOFILE, &lowered), 0);
+	const int rc = RunHamArc({"-x", "--threads", "4", "-f", archive_.string()}, work_ / "out");
+	ASSERT_EQ(setrlimit(RLIMIT_NOFILE, &original), 0);
+
+	EXPECT_EQ(rc, 0);
+	for (const auto& input : inputs) {
+		EXPECT_TRUE(FilesEqual(input, work_ / "out" / input.filename())) << input.filename();
+	}
+}
+#endif
+
+TEST_F(HamArcTest, CreateOutputDoesNotDependOnThreadCount) {
+	std::vector<std::string> paths;
+	for (std::size_t size : {0u, 1u, 4097u, 3u * (1u << 20) + 5u, 70000u}) {
+		paths.push_back(MakeFile("file" + std::to_string(size), RandomData(size, static_cast<unsigned>(size))).string());
+	}
+
+	std::vector<char> expected;
+	for (unsigned threads : {1u, 2u, 8u}) {
+		hamarc::CreateOptions options;
+		options.threads = threads;
+		ASSERT_TRUE(hamarc::CreateArchive(archive_.string(), paths, options));
+		if (expected.empty()) {
+			expected = ReadBytes(archive_);
+		} else {
+			EXPECT_EQ(ReadBytes(archive_), expected) << threads << " threads";
+		}
+	}
+}
+
+TEST_F(HamArcTest, FailedCreateLeavesAnExistingArchiveAlone) {
+	const fs::path file = MakeFile("file.bin", RandomData(300000, 53));
+	ASSERT_EQ(RunHamArc({"-c", "-f", archive_.string(), file.string()}), 0);
+	const std::vector<char> created = ReadBytes(archive_);
+
+	fs::create_directory(work_ / "directory");
+	for (const fs::path& bad : {work_ / "missing.bin", work_ / "directory"}) {
+		EXPECT_NE(RunHamArc({"-c", "-f", archive_.string(), file.string(), bad.string()}), 0) << bad;
+		EXPECT_EQ(ReadBytes(archive_), created) << bad;
+		EXPECT_FALSE(fs::exists(archive_.string() + ".tmp")) << bad;
+	}
+	ExpectExtractsTo({file});
+}
+
+TEST_F(HamArcTest, CreateRoundTripsEveryCodecAndDepth) {
+	const fs::path first = MakeFile("first.bin", RandomData(2 * (1 << 20) + 99, 51));
+	const fs::path second = MakeFile("second.bin", RandomData(333, 52));
+	for (std::string codec : {"hamming84", "secded72"}) {
+		for (std::string depth : {"0", "8", "64"}) {
+			ASSERT_EQ(RunHamArc({"-c", "-f", archive_.string(), "--codec", codec, "--interleave", depth,
+			                     "--threads", "3", first.string(), second.string()}), 0);
+			ExpectExtractsTo({first, second});
+		}
+	}
+}
+
+TEST_F(HamArcTest, LoadSurvivesAnAppendCutShort) {
+	const fs::path first = MakeFile("first.bin", RandomData(40000, 61));
+	const fs::path second = MakeFile("second.bin", RandomData(50000, 62));
+	const fs::path third = MakeFile("third.bin", RandomData(3000, 63));
+	ASSERT_EQ(RunHamArc({"-c", "-f", archive_.string(), first.string()}), 0);
+	const std::uintmax_t committed = fs::file_size(archive_);
+	ASSERT_EQ(RunHamArc({"-a", "-f", archive_.string(), second.string()}), 0);
+	const std::vector<char> appended = ReadBytes(archive_);
+
+	// Inside the payload, inside the index block, and inside the footer.
+	for (std::uintmax_t cut : {committed + 1, committed + 60000, appended.size() - 100, appended.size() - 1}) {
+		WriteBytes(archive_, std::vector<char>(appended.begin(), appended.begin() + cut));
+		hamarc::ArchiveState state;
+		state.archivePath = archive_.string();
+		ASSERT_TRUE(hamarc::LoadArchive(state)) << "cut at " << cut;
+		EXPECT_EQ(hamarc::ListFiles(state), std::vector<std::string>{"first.bin"}) << "cut at " << cut;
+		ExpectExtractsTo({first});
+	}
+
+	// Appending behind the torn tail commits a new index again.
+	ASSERT_EQ(RunHamArc({"-a", "-f", archive_.string(), third.string()}), 0);
+	hamarc::ArchiveState state;
+	state.archivePath = archive_.string();
+	ASSERT_TRUE(hamarc::LoadArchive(state));
+	EXPECT_EQ(hamarc::ListFiles(state), (std::vector<std::string>{"first.bin", "third.bin"}));
+	ExpectExtractsTo({first, third});
+}
+
+TEST_F(HamArcTest, LoadFailsOnUncorrectableIndexRecord) {
+	const fs::path file = MakeFile("file.bin", RandomData(1000, 64));
+	ASSERT_EQ(RunHamArc({"-c", "-f", archive_.string(), file.string()}), 0);
+
+	hamarc::ArchiveState state;
+	state.archivePath = archive_.string();
+	ASSERT_TRUE(hamarc::LoadArchive(state));
+
+	// The record sits between the index header and the 16 encoded name bytes.
+	const std::uintmax_t record = fs::file_size(archive_) - sizeof(hamarc::EncodedFooter) - 16
+	                              - sizeof(hamarc::EncodedIndexRecord);
+	FlipBit(archive_, record + 20, 0);
+	FlipBit(archive_, record + 20, 1);
+	EXPECT_FALSE(hamarc::LoadArchive(state));
+	EXPECT_FALSE(hamarc::OpenArchive(state) && hamarc::ExtractFile(state, "file.bin", (work_ / "out" / "x").string()));
+}
+
+static std::vector<std::string> ListArchive(const fs::path& archive) {
+	hamarc::ArchiveState state;
+	state.archivePath = archive.string();
+	return hamarc::LoadArchive(state) ? hamarc::ListFiles(state) : std::vector<std::string>{};
+}
+
+TEST_F(HamArcTest, DeleteAppendsTombstonesUntilCompaction) {
+	const fs::path a = MakeFile("a.bin", RandomData(100000, 71));
+	const fs::path b = MakeFile("b.bin", RandomData(200000, 72));
+	const fs::path c = MakeFile("c.bin", RandomData(300000, 73));
+	ASSERT_EQ(RunHamArc({"-c", "-f", archive_.string(), a.string(), b.string(), c.string()}), 0);
+	const std::uintmax_t created = fs::file_size(archive_);
+
+	ASSERT_EQ(RunHamArc({"-d", "-f", archive_.string(), "b.bin"}), 0);
+	EXPECT_GT(fs::file_size(archive_), created);
+	EXPECT_EQ(ListArchive(archive_), (std::vector<std::string>{"a.bin", "c.bin"}));
+
+	hamarc::ArchiveState state;
+	state.archivePath = archive_.string();
+	EXPECT_FALSE(hamarc::KillFile(state, "b.bin"));
+	EXPECT_FALSE(hamarc::KillFile(state, "missing.bin"));
+
+	ASSERT_EQ(RunHamArc({"--compact", "-f", archive_.string()}), 0);
+	EXPECT_LT(fs::file_size(archive_), created - 2 * 200000 + 1000);
+	EXPECT_EQ(ListArchive(archive_), (std::vector<std::string>{"a.bin", "c.bin"}));
+	ExpectExtractsTo({a, c});
+
+	// A deleted name can be added again, before and after compaction.
+	ASSERT_EQ(RunHamArc({"-d", "-f", archive_.string(), "a.bin"}), 0);
+	ASSERT_EQ(RunHamArc({"-a", "-f", archive_.string(), a.string()}), 0);
+	EXPECT_EQ(ListArchive(archive_), (std::vector<std::string>{"a.bin", "c.bin"}));
+	ExpectExtractsTo({a, c});
+}
+
+TEST_F(HamArcTest, CompactConvertsTheLegacyLayout) {
+	const std::vector<std::vector<char>> contents = {RandomData(5000, 74), RandomData(1, 75), RandomData(777, 76)};
+	const std::vector<std::string> names = {"one", "two", "three"};
+
+	// Format 1: header, a fixed entry table, then the payloads.
+	hamarc::FileHeader header;
+	header.fileCount = static_cast<unsigned int>(contents.size());
+	header.totalSize = 0;
+	std::vector<char> legacy = hamarc::EncodeHeader(header);
+	unsigned long long offset = legacy.size() + contents.size() * sizeof(hamarc::EncodedFileEntry);
+	std::vector<char> payloads;
+	for (std::size_t i = 0; i < contents.size(); i++) {
+		hamarc::FileEntry entry = {};
+		std::strncpy(entry.filename, names[i].c_str(), sizeof(entry.filename) - 1);
+		entry.originalSize = contents[i].size();
+		entry.encodedSize = 2 * contents[i].size();
+		entry.offset = offset + payloads.size();
+		std::vector<char> encoded_entry = hamarc::EncodeFileEntry(entry);
+		legacy.insert(legacy.end(), encoded_entry.begin(), encoded_entry.end());
+		std::vector<char> payload = hammingcoder::EncodeBuffer(contents[i].data(), contents[i].size());
+		payloads.insert(payloads.end(), payload.begin(), payload.end());
+	}
+	legacy.insert(legacy.end(), payloads.begin(), payloads.end());
+	WriteBytes(archive_, legacy);
+
+	hamarc::ArchiveState state;
+	state.archivePath = archive_.string();
+	ASSERT_TRUE(hamarc::LoadArchive(state));
+	EXPECT_EQ(state.format, hamarc::kFormatLegacy);
+	ASSERT_TRUE(hamarc::CompactArchive(state));
+	EXPECT_EQ(state.format, hamarc::kFormatLog);
+	EXPECT_EQ(ListArchive(archive_), (std::vector<std::string>{"one", "three", "two"}));
+	for (std::size_t i = 0; i < contents.size(); i++) {
+		const fs::path output = work_ / "out" / names[i];
+		ASSERT_TRUE(hamarc::ExtractFile(state, names[i], output.string()));
+		EXPECT_EQ(ReadBytes(output), contents[i]) << names[i];
+	}
+}
+
+TEST_F(HamArcTest, ConcatenateCopiesMembersOfBothArchives) {
+	const fs::path a = MakeFile("a.bin", RandomData(70000, 81));
+	const fs::path b = MakeFile("b.bin", RandomData(80000, 82));
+	ASSERT_TRUE(fs::create_directory(work_ / "newer"));
+	const fs::path b2 = MakeFile("newer/b.bin", RandomData(90, 83));
+	const fs::path first = work_ / "first.haf";
+	const fs::path second = work_ / "second.haf";
+	ASSERT_EQ(RunHamArc({"-c", "-f", first.string(), a.string(), b.string()}), 0);
+	ASSERT_EQ(RunHamArc({"-c", "-f", second.string(), b2.string()}), 0);
+
+	// Members of the second archive win.
+	ASSERT_EQ(RunHamArc({"-A", "-f", archive_.string(), first.string(), second.string()}), 0);
+	EXPECT_EQ(ListArchive(archive_), (std::vector<std::string>{"a.bin", "b.bin"}));
+	ExpectExtractsTo({a});
+	EXPECT_TRUE(FilesEqual(b2, work_ / "out" / "b.bin"));
+
+	const fs::path other = work_ / "other.haf";
+	ASSERT_EQ(RunHamArc({"-c", "-f", other.string(), "--codec", "secded72", a.string()}), 0);
+	EXPECT_FALSE(hamarc::ConcatenateArchives(first.string(), other.string(), archive_.string()));
+}
+
+TEST_F(HamArcTest, ConcatenateIntoOneOfItsInputs) {
+	const fs::path a = MakeFile("a.bin", RandomData(2 * (1 << 20) + 1, 84));
+	const fs::path b = MakeFile("b.bin", RandomData(5000, 85));
+	const fs::path second = work_ / "second.haf";
+	ASSERT_EQ(RunHamArc({"-c", "-f", archive_.string(), a.string()}), 0);
+	ASSERT_EQ(RunHamArc({"-c", "-f", second.string(), b.string()}), 0);
+
+	ASSERT_TRUE(hamarc::ConcatenateArchives(archive_.string(), second.string(), archive_.string()));
+	EXPECT_EQ(ListArchive(archive_), (std::vector<std::string>{"a.bin", "b.bin"}));
+	ExpectExtractsTo({a, b});
+
+	ASSERT_TRUE(hamarc::ConcatenateArchives(second.string(), archive_.string(), archive_.string()));
+	EXPECT_EQ(ListArchive(archive_), (std::vector<std::string>{"a.bin", "b.bin"}));
+	ExpectExtractsTo({a, b});
+	EXPECT_FALSE(fs::exists(archive_.string() + ".tmp"));
+}
+
+static hamarc::MemberEntry Member(std::string_view name, unsigned long long size) {
+	hamarc::MemberEntry entry = {};
+	entry.name = name;
+	entry.originalSize = size;
+	return entry;
+}
+
+// Names whose home slot in a table of `slots` is `home`.
+static std::vector<std::string> NamesHomedAt(std::size_t home, std::size_t slots, std::size_t count) {
+	std::vector<std::string> names;
+	for (int i = 0; names.size() < count; i++) {
+		std::string name = "member" + std::to_string(i);
+		if ((std::hash<std::string_view>{}(name) & (slots - 1)) == home) {
+			names.push_back(name);
+		}
+	}
+	return names;
+}
+
+TEST(MemberIndex, EraseInsideAWrappedCluster) {
+	// Three names homed at the last of the 16 initial slots fill slots 15,
+	// 0 and 1; one homed at slot 0 is pushed to slot 2.
+	std::vector<std::string> wrapped = NamesHomedAt(15, 16, 3);
+	std::vector<std::string> first = NamesHomedAt(0, 16, 1);
+	for (std::size_t erased = 0; erased < 4; erased++) {
+		hamarc::MemberIndex index;
+		std::vector<std::string> names = wrapped;
+		names.push_back(first[0]);
+		for (std::size_t i = 0; i < names.size(); i++) {
+			index.Insert(Member(names[i], i));
+		}
+		ASSERT_TRUE(index.Erase(names[erased]));
+		EXPECT_FALSE(index.Erase(names[erased]));
+		EXPECT_EQ(index.Find(names[erased]), nullptr);
+		EXPECT_EQ(index.Size(), names.size() - 1);
+		for (std::size_t i = 0; i < names.size(); i++) {
+			if (i == erased) continue;
+			const hamarc::MemberEntry* entry = index.Find(names[i]);
+			ASSERT_NE(entry, nullptr) << "erased " << erased << ", looking for " << i;
+			EXPECT_EQ(entry->name, names[i]);
+			EXPECT_EQ(entry->originalSize, i);
+		}
+	}
+}
+
+TEST(MemberIndex, EraseThenInsertTheSameName) {
+	hamarc::MemberIndex index;
+	index.Insert(Member("a", 1));
+	index.Insert(Member("b", 2));
+	ASSERT_TRUE(index.Erase("a"));
+	index.Insert(Member("a", 3));
+	ASSERT_NE(index.Find("a"), nullptr);
+	EXPECT_EQ(index.Find("a")->originalSize, 3u);
+	EXPECT_EQ(index.Find("b")->originalSize, 2u);
+	EXPECT_EQ(index.Size(), 2u);
+
+	index.Insert(Member("a", 4));
+	EXPECT_EQ(index.Size(), 2u);
+	EXPECT_EQ(index.Find("a")->originalSize, 4u);
+}
+
+TEST(MemberIndex, CopyOutlivesItsSource) {
+	hamarc::MemberIndex copy;
+	hamarc::MemberIndex assigned;
+	assigned.Insert(Member("stale", 0));
+	{
+		hamarc::MemberIndex source;
+		for (int i = 0; i < 100; i++) {
+			std::string name = "file" + std::to_string(i);
+			source.Insert(Member(name, i));
+		}
+		source.Erase("file7");
+		hamarc::MemberIndex copied(source);
+		copy = std::move(copied);
+		assigned = source;
+		source.Insert(Member("file7", 7));
+	}
+	for (const hamarc::MemberIndex* index : {&copy, &assigned}) {
+		EXPECT_EQ(index->Size(), 99u);
+		EXPECT_EQ(index->Find("file7"), nullptr);
+		EXPECT_EQ(index->Find("stale"), nullptr);
+		for (int i = 0; i < 100; i++) {
+			if (i == 7) continue;
+			std::string name = "file" + std::to_string(i);
+			const hamarc::MemberEntry* entry = index->Find(name);
+			ASSERT_NE(entry, nullptr) << name;
+			EXPECT_EQ(entry->name, name);
+			EXPECT_EQ(entry->originalSize, static_cast<unsigned long long>(i));
+		}
+	}
+}
+
+TEST(MemberIndex, GrowsAcrossRehashesAndMatchesAMap) {
+	std::mt19937 rng(91);
+	std::uniform_int_distribution<int> pick(0, 19999);
+	hamarc::MemberIndex index;
+	std::map<std::string, unsigned long long> model;
+	for (int step = 0; step < 60000; step++) {
+		std::string name = "n" + std::to_string(pick(rng)) + std::string(step % 7, 'x');
+		if (step % 3 == 2) {
+			EXPECT_EQ(index.Erase(name), model.erase(name) == 1);
+		} else {
+			index.Insert(Member(name, step));
+			model[name] = step;
+		}
+	}
+	ASSERT_EQ(index.Size(), model.size());
+	ASSERT_GT(model.size(), 10000u);
+	for (const auto& [name, size] : model) {
+		const hamarc::MemberEntry* entry = index.Find(name);
+		ASSERT_NE(entry, nullptr) << name;
+		EXPECT_EQ(entry->originalSize, size);
+	}
+	std::vector<const hamarc::MemberEntry*> sorted = index.SortedByName();
+	ASSERT_EQ(sorted.size(), model.size());
+	auto expected = model.begin();
+	for (const hamarc::MemberEntry* entry : sorted) {
+		EXPECT_EQ(entry->name, (expected++)->first);
+	}
+}
+
+// Every name in `names` resolves the same way through the lazy lookup of
+// a freshly opened archive as through a fully loaded index.
+static void ExpectLazyLookupMatchesLoad(const fs::path& archive, const std::vector<std::string>& names) {
+	hamarc::ArchiveState loaded;
+	loaded.archivePath = archive.string();
+	ASSERT_TRUE(hamarc::LoadArchive(loaded));
+	hamarc::ArchiveState opened;
+	opened.archivePath = archive.string();
+	ASSERT_TRUE(hamarc::OpenArchive(opened));
+	ASSERT_FALSE(opened.indexLoaded);
+
+	hamarc::ArchiveReader reader(archive.string());
+	for (const std::string& name : names) {
+		const hamarc::MemberEntry* expected = loaded.files.Find(name);
+		hamarc::MemberEntry entry = {};
+		ASSERT_EQ(hamarc::FindMember(opened, reader, name, entry), expected != nullptr) << name;
+		if (expected) {
+			EXPECT_EQ(entry.name, name);
+			EXPECT_EQ(entry.offset, expected->offset) << name;
+			EXPECT_EQ(entry.originalSize, expected->originalSize) << name;
+			EXPECT_EQ(entry.encodedSize, expected->encodedSize) << name;
+			EXPECT_EQ(entry.contentHash, expected->contentHash) << name;
+		}
+	}
+}
+
+TEST_F(HamArcTest, LazyLookupMatchesLoadAfterAddsAndDeletes) {
+	std::vector<std::string> names = {"missing"};
+	std::vector<std::string> paths;
+	for (int i = 0; i < 6; i++) {
+		names.push_back("f" + std::to_string(i));
+		paths.push_back(MakeFile(names.back(), RandomData(100 + i, 200 + i)).string());
+	}
+	ASSERT_TRUE(hamarc::CreateArchive(archive_.string(), {paths[0], paths[1], paths[2]}));
+	ExpectLazyLookupMatchesLoad(archive_, names);
+
+	hamarc::ArchiveState state;
+	state.archivePath = archive_.string();
+	ASSERT_TRUE(hamarc::AppendFile(state, paths[3]));
+	ASSERT_TRUE(hamarc::KillFile(state, "f1"));
+	ExpectLazyLookupMatchesLoad(archive_, names);
+	ASSERT_TRUE(hamarc::AppendFile(state, paths[1]));      // re-added after its tombstone
+	ASSERT_TRUE(hamarc::KillFile(state, "f3"));            // deleted in a later block than its add
+	WriteBytes(paths[0], RandomData(50, 250));
+	ASSERT_TRUE(hamarc::AppendFile(state, paths[0]));      // replaces the snapshot's entry
+	ExpectLazyLookupMatchesLoad(archive_, names);
+
+	ASSERT_TRUE(hamarc::CompactArchive(state));
+	ASSERT_TRUE(hamarc::KillFile(state, "f2"));
+	ExpectLazyLookupMatchesLoad(archive_, names);
+}
+
+TEST_F(HamArcTest, AppendsWriteASnapshotEveryFewBlocks) {
+	const fs::path seed = MakeFile("seed.bin", RandomData(10, 260));
+	ASSERT_TRUE(hamarc::CreateArchive(archive_.string(), {seed.string()}));
+
+	std::vector<std::string> names = {"seed.bin"};
+	hamarc::ArchiveState state;
+	state.archivePath = archive_.string();
+	unsigned longest = 0;
+	for (int i = 0; i < 80; i++) {
+		names.push_back("g" + std::to_string(i));
+		ASSERT_TRUE(hamarc::AppendFile(state, MakeFile(names.back(), RandomData(20 + i, 300 + i)).string()));
+		if (i % 5 == 4) {
+			ASSERT_TRUE(hamarc::KillFile(state, names[names.size() - 3]));
+		}
+		hamarc::ArchiveState loaded;
+		loaded.archivePath = archive_.string();
+		ASSERT_TRUE(hamarc::LoadArchive(loaded));
+		EXPECT_EQ(loaded.files.Size(), state.files.Size());
+		longest = std::max(longest, loaded.deltaBlocks);
+	}
+	EXPECT_EQ(longest, 31u);
+	ExpectLazyLookupMatchesLoad(archive_, names);
+}
+
+TEST_F(HamArcTest, EmptyMembersDoNotShareTheNextPayload) {
+	const fs::path empty = MakeFile("empty.bin", {});
+	const fs::path full = MakeFile("full.bin", RandomData(3000, 90));
+	const fs::path also_empty = MakeFile("also_empty.bin", {});
+	ASSERT_EQ(RunHamArc({"-c", "-f", archive_.string(), empty.string(), full.string(), also_empty.string()}), 0);
+
+	// All three start at one offset; only the empty ones share a payload.
+	EXPECT_EQ(RunHamArc({"--verify", "-f", archive_.string()}), 0);
+	EXPECT_EQ(RunHamArc({"--compact", "-f", archive_.string()}), 0);
+	ExpectExtractsTo({empty, full, also_empty});
+
+	const std::vector<char> clean = ReadBytes(archive_);
+	FlipBit(archive_, clean.size() / 2, 3);
+	EXPECT_EQ(RunHamArc({"--scrub", "-f", archive_.string()}), 0);
+	EXPECT_EQ(ReadBytes(archive_), clean);
+}
+
+static hamarc::MemberEntry LoadedMember(const fs::path& archive, const std::string& name) {
+	hamarc::ArchiveState state;
+	state.archivePath = archive.string();
+	EXPECT_TRUE(hamarc::LoadArchive(state));
+	const hamarc::MemberEntry* entry = state.files.Find(name);
+	EXPECT_NE(entry, nullptr) << name;
+	return entry ? *entry : hamarc::MemberEntry{};
+}
+
+// XXH64 over the little-endian XXH64 digests of the data's 1 MiB pieces.
+static std::uint64_t ContentHashOf(const std::vector<char>& data) {
+	std::vector<std::byte> combined;
+	for (std::size_t begin = 0; begin < data.size(); begin += 1 << 20) {
+		const std::size_t size = std::min<std::size_t>(1 << 20, data.size() - begin);
+		const std::uint64_t digest = hammingcoder::HashBytes(std::as_bytes(std::span(data).subspan(begin, size)));
+		for (int i = 0; i < 8; i++) {
+			combined.push_back(static_cast<std::byte>(digest >> (8 * i)));
+		}
+	}
+	return hammingcoder::HashBytes(combined);
+}
+
+TEST_F(HamArcTest, ContentHashCombinesDigestsOfMebibytePieces) {
+	const std::vector<char> data = RandomData(2 * (1 << 20) + 5, 95);
+	const fs::path file = MakeFile("file.bin", data);
+	const std::uint64_t expected = ContentHashOf(data);
+
+	ASSERT_EQ(RunHamArc({"-c", "-f", archive_.string(), file.string()}), 0);
+	EXPECT_EQ(LoadedMember(archive_, "file.bin").contentHash, expected);
+	if (hamarc::IsCompressionAvailable(hamarc::kCompressionDeflate)) {
+		ASSERT_EQ(RunHamArc({"-c", "-f", archive_.string(), "--compress", "deflate", file.string()}), 0);
+		EXPECT_EQ(LoadedMember(archive_, "file.bin").contentHash, expected);
+	}
+	hamarc::ArchiveState state;
+	state.archivePath = (work_ / "appended.haf").string();
+	ASSERT_TRUE(hamarc::CreateArchive(state.archivePath, {}));
+	ASSERT_TRUE(hamarc::AppendFile(state, file.string()));
+	EXPECT_EQ(LoadedMember(state.archivePath, "file.bin").contentHash, expected);
+}
+
+TEST_F(HamArcTest, CreateSharesThePayloadOfIdenticalInputs) {
+	const std::vector<char> data = RandomData(3 * (1 << 20) + 7, 96);
+	const fs::path first = MakeFile("first.bin", data);
+	const fs::path copy = MakeFile("copy.bin", data);
+	const fs::path same_size = MakeFile("same_size.bin", RandomData(data.size(), 97));
+	const fs::path other = MakeFile("other.bin", RandomData(5000, 98));
+	ASSERT_EQ(RunHamArc({"-c", "-f", archive_.string(), "--threads", "4", first.string(), copy.string(),
+	                     same_size.string(), other.string()}), 0);
+
+	const hamarc::MemberEntry a = LoadedMember(archive_, "first.bin");
+	const hamarc::MemberEntry b = LoadedMember(archive_, "copy.bin");
+	const hamarc::MemberEntry c = LoadedMember(archive_, "same_size.bin");
+	EXPECT_EQ(a.offset, b.offset);
+	EXPECT_EQ(a.contentHash, b.contentHash);
+	EXPECT_NE(a.offset, c.offset);
+	EXPECT_NE(a.contentHash, c.contentHash);
+	// Two payloads of the large size, not three.
+	EXPECT_LT(fs::file_size(archive_), 3 * a.encodedSize);
+	EXPECT_EQ(RunHamArc({"--verify", "-f", archive_.string()}), 0);
+	ExpectExtractsTo({first, copy, same_size, other});
+}
+
+TEST_F(HamArcTest, AppendSharesThePayloadOfAnIdenticalMember) {
+	const std::vector<char> data = RandomData(200000, 99);
+	const fs::path first = MakeFile("first.bin", data);
+	const fs::path copy = MakeFile("copy.bin", data);
+	const fs::path same_size = MakeFile("same_size.bin", RandomData(data.size(), 100));
+	ASSERT_EQ(RunHamArc({"-c", "-f", archive_.string(), first.string()}), 0);
+	const std::uintmax_t created = fs::file_size(archive_);
+
+	ASSERT_EQ(RunHamArc({"-a", "-f", archive_.string(), copy.string()}), 0);
+	EXPECT_LT(fs::file_size(archive_), created + data.size());
+	EXPECT_EQ(LoadedMember(archive_, "copy.bin").offset, LoadedMember(archive_, "first.bin").offset);
+
+	ASSERT_EQ(RunHamArc({"-a", "-f", archive_.string(), same_size.string()}), 0);
+	EXPECT_NE(LoadedMember(archive_, "same_size.bin").offset, LoadedMember(archive_, "first.bin").offset);
+	EXPECT_EQ(RunHamArc({"--verify", "-f", archive_.string()}), 0);
+	ExpectExtractsTo({first, copy, same_size});
+}
+
+template <typename T>
+static void AppendEncoded(std::vector<char>& out, const T& value) {
+	std::vector<char> encoded = hammingcoder::EncodeBuffer(reinterpret_cast<const char*>(&value), sizeof(T));
+	out.insert(out.end(), encoded.begin(), encoded.end());
+}
+
+// Writes a format 3 archive by hand: one Hamming(8,4) payload per member
+// and a single delta index block. `tweak` may damage a record before it
+// is encoded.
+static void WriteLogArchive(const fs::path& path, const std::vector<std::pair<std::string, std::vector<char>>>& members,
+                            const std::function<void(std::size_t, hamarc::IndexRecord&)>& tweak = nullptr) {
+	hamarc::FileHeader header = {};
+	header.magic[3] = hamarc::kFormatLog;
+	std::vector<char> archive = hamarc::EncodeHeader(header);
+	hamarc::CodecHeader codec = {};
+	codec.codec = hammingcoder::kCodecHamming84;
+	AppendEncoded(archive, codec);
+
+	std::string names;
+	std::vector<hamarc::IndexRecord> records;
+	for (const auto& [name, data] : members) {
+		hamarc::IndexRecord record = {};
+		record.originalSize = data.size();
+		record.encodedSize = 2 * data.size();
+		record.offset = archive.size();
+		record.nameOffset = static_cast<unsigned int>(names.size());
+		record.nameSize = static_cast<unsigned int>(name.size());
+		record.kind = hamarc::kRecordAdd;
+		records.push_back(record);
+		names += name;
+		std::vector<char> payload = hammingcoder::EncodeBuffer(data.data(), data.size());
+		archive.insert(archive.end(), payload.begin(), payload.end());
+	}
+
+	const unsigned long long index = archive.size();
+	hamarc::IndexHeader index_header = {};
+	index_header.magic[3] = hamarc::kIndexDelta;
+	index_header.recordCount = static_cast<unsigned int>(records.size());
+	index_header.namesSize = names.size();
+	AppendEncoded(archive, index_header);
+	for (std::size_t i = 0; i < records.size(); i++) {
+		if (tweak) tweak(i, records[i]);
+		AppendEncoded(archive, records[i]);
+	}
+	std::vector<char> encoded_names = hammingcoder::EncodeBuffer(names.data(), names.size());
+	archive.insert(archive.end(), encoded_names.begin(), encoded_names.end());
+	hamarc::Footer footer = {};
+	footer.index = index;
+	AppendEncoded(archive, footer);
+	WriteBytes(path, archive);
+}
+
+TEST_F(HamArcTest, NameBlobHoldsLongEmptyAndOddLengthNames) {
+	const std::vector<std::pair<std::string, std::vector<char>>> members = {
+		{std::string(300, 'L') + ".bin", RandomData(1000, 401)},
+		{"", RandomData(10, 402)},
+		{"a", RandomData(11, 403)},
+		{"odd", {}},
+		{std::string(1000, 'x'), RandomData(3, 404)},
+	};
+	WriteLogArchive(archive_, members);
+
+	hamarc::ArchiveState state;
+	state.archivePath = archive_.string();
+	ASSERT_TRUE(hamarc::LoadArchive(state));
+	std::vector<std::string> expected;
+	for (const auto& [name, data] : members) {
+		expected.push_back(name);
+	}
+	std::sort(expected.begin(), expected.end());
+	EXPECT_EQ(hamarc::ListFiles(state), expected);
+	ExpectLazyLookupMatchesLoad(archive_, expected);
+
+	// Compaction writes its own name blob; the names and contents survive it.
+	ASSERT_TRUE(hamarc::CompactArchive(state));
+	EXPECT_EQ(hamarc::ListFiles(state), expected);
+	ExpectLazyLookupMatchesLoad(archive_, expected);
+	for (const auto& [name, data] : members) {
+		const fs::path output = work_ / "out" / "member";
+		ASSERT_TRUE(hamarc::ExtractFile(state, name, output.string())) << name.size();
+		EXPECT_EQ(ReadBytes(output), data) << name.size();
+	}
+}
+
+TEST_F(HamArcTest, LoadRejectsNameSlicesOutsideTheBlob) {
+	const std::vector<std::pair<std::string, std::vector<char>>> members = {
+		{"first", RandomData(10, 405)},
+		{"second", RandomData(20, 406)},
+	};
+	const std::vector<std::function<void(hamarc::IndexRecord&)>> damage = {
+		[](hamarc::IndexRecord& record) { record.nameOffset = 100; },
+		[](hamarc::IndexRecord& record) { record.nameSize = 7; },
+		[](hamarc::IndexRecord& record) { record.nameOffset = 0xFFFFFFFFu; },
+		[](hamarc::IndexRecord& record) { record.nameSize = 0xFFFFFFFFu; },
+	};
+	for (std::size_t d = 0; d < damage.size(); d++) {
+		WriteLogArchive(archive_, members, [&](std::size_t i, hamarc::IndexRecord& record) {
+			if (i == 1) damage[d](record);
+		});
+		hamarc::ArchiveState state;
+		state.archivePath = archive_.string();
+		EXPECT_FALSE(hamarc::LoadArchive(state)) << "damage " << d;
+
+		ASSERT_TRUE(hamarc::OpenArchive(state));
+		hamarc::ArchiveReader reader(archive_.string());
+		hamarc::MemberEntry entry = {};
+		EXPECT_FALSE(hamarc::FindMember(state, reader, "second", entry)) << "damage " << d;
+	}
+}
+
+TEST_F(HamArcTest, VerifyCatchesDataThatDecodesCleanlyButDoesNotMatch) {
+	const std::vector<char> data = RandomData(3 * (1 << 20) + 17, 120);
+	const fs::path first = MakeFile("first.bin", data);
+	const fs::path copy = MakeFile("copy.bin", data);
+	const fs::path other = MakeFile("other.bin", RandomData(7000, 121));
+	ASSERT_EQ(RunHamArc({"-c", "-f", archive_.string(), first.string(), copy.string(), other.string()}), 0);
+	EXPECT_EQ(RunHamArc({"--verify", "-f", archive_.string()}), 0);
+
+	// Valid codewords for other bytes in the last mebibyte of the shared payload.
+	const hamarc::MemberEntry entry = LoadedMember(archive_, "first.bin");
+	const std::vector<char> swapped = hammingcoder::EncodeBuffer("\x5a\xa5", 2);
+	{
+		std::fstream file(archive_, std::ios::binary | std::ios::in | std::ios::out);
+		file.seekp(static_cast<std::streamoff>(entry.offset + entry.encodedSize - 200));
+		file.write(swapped.data(), static_cast<std::streamsize>(swapped.size()));
+	}
+
+	hamarc::ArchiveState state;
+	state.archivePath = archive_.string();
+	ASSERT_TRUE(hamarc::LoadArchive(state));
+	for (unsigned threads : {1u, 4u}) {
+		hamarc::VerifyReport report;
+		ASSERT_TRUE(hamarc::VerifyArchive(state, report, threads));
+		EXPECT_EQ(report.members, 3u);
+		EXPECT_EQ(report.unchecked, 0u);
+		EXPECT_EQ(report.decode.uncorrectable, 0u);
+		std::vector<std::string> failed = report.failed;
+		std::sort(failed.begin(), failed.end());
+		EXPECT_EQ(failed, (std::vector<std::string>{"copy.bin", "first.bin"})) << threads << " threads";
+	}
+	EXPECT_NE(RunHamArc({"--verify", "-f", archive_.string()}), 0);
+}
+
+TEST_F(HamArcTest, VerifyCountsMembersWithoutAChecksum) {
+	const std::vector<std::pair<std::string, std::vector<char>>> members = {
+		{"unchecked", RandomData(3000, 122)},
+		{"checked", RandomData(4000, 123)},
+		{"empty", {}},
+	};
+	WriteLogArchive(archive_, members, [&](std::size_t i, hamarc::IndexRecord& record) {
+		if (i > 0) record.contentHash = ContentHashOf(members[i].second);
+	});
+
+	hamarc::ArchiveState state;
+	state.archivePath = archive_.string();
+	ASSERT_TRUE(hamarc::LoadArchive(state));
+	hamarc::VerifyReport report;
+	ASSERT_TRUE(hamarc::VerifyArchive(state, report));
+	EXPECT_EQ(report.members, 3u);
+	EXPECT_EQ(report.unchecked, 1u);
+	EXPECT_TRUE(report.failed.empty());
+	EXPECT_EQ(RunHamArc({"--verify", "-f", archive_.string()}), 0);
+
+	// A wrong checksum fails only its own member.
+	WriteLogArchive(archive_, members, [&](std::size_t i, hamarc::IndexRecord& record) {
+		record.contentHash = ContentHashOf(members[i].second) + (i == 1);
+	});
+	ASSERT_TRUE(hamarc::LoadArchive(state));
+	report = {};
+	ASSERT_TRUE(hamarc::VerifyArchive(state, report));
+	EXPECT_EQ(report.unchecked, 0u);
+	EXPECT_EQ(report.failed, std::vector<std::string>{"checked"});
+	EXPECT_NE(RunHamArc({"--verify", "-f", archive_.string()}), 0);
+	EXPECT_NE(RunHamArc({"--verify", "-f", (work_ / "missing.haf").string()}), 0);
+}
+
+static std::vector<char> TextData(std::size_t size) {
+	const std::string line = "2024-05-01 12:00:00 INFO request served in 12 ms\n";
+	std::vector<char> data(size);
+	for (std::size_t i = 0; i < size; i++) {
+		data[i] = line[i % line.size()];
+	}
+	return data;
+}
+
+TEST_F(HamArcTest, DeflateRoundTripsIncompressibleAndEmptyFiles) {
+	if (!hamarc::IsCompressionAvailable(hamarc::kCompressionDeflate)) {
+		GTEST_SKIP() << "built without zlib";
+	}
+	const fs::path random = MakeFile("random.bin", RandomData(3 * (1 << 20) + 11, 110));
+	const fs::path empty = MakeFile("empty.bin", {});
+	const fs::path text = MakeFile("text.log", TextData(2 * (1 << 20)));
+	ASSERT_EQ(RunHamArc({"-c", "-f", archive_.string(), "--compress", "deflate", random.string(), empty.string(),
+	                     text.string()}), 0);
+
+	// Stored blocks add a few bytes per 64 KiB to data that does not shrink.
+	const hamarc::MemberEntry stored = LoadedMember(archive_, "random.bin");
+	EXPECT_EQ(stored.compression, hamarc::kCompressionDeflate);
+	EXPECT_LT(stored.encodedSize, 2 * (stored.originalSize + stored.originalSize / 100));
+	EXPECT_EQ(LoadedMember(archive_, "empty.bin").originalSize, 0u);
+	EXPECT_LT(LoadedMember(archive_, "text.log").encodedSize, fs::file_size(text) / 10);
+	EXPECT_EQ(RunHamArc({"--verify", "-f", archive_.string()}), 0);
+	ExpectExtractsTo({random, empty, text});
+}
+
+TEST_F(HamArcTest, DeflateRejectsAStreamThatDecodesCleanlyButDoesNotInflate) {
+	if (!hamarc::IsCompressionAvailable(hamarc::kCompressionDeflate)) {
+		GTEST_SKIP() << "built without zlib";
+	}
+	const fs::path text = MakeFile("text.log", TextData(100000));
+	ASSERT_EQ(RunHamArc({"-c", "-f", archive_.string(), "--compress", "deflate", text.string()}), 0);
+
+	// Valid codewords over the zlib header: no bit errors, but no stream either.
+	const std::vector<char> garbage = hammingcoder::EncodeBuffer("\xff\xff", 2);
+	const hamarc::MemberEntry entry = LoadedMember(archive_, "text.log");
+	{
+		std::fstream file(archive_, std::ios::binary | std::ios::in | std::ios::out);
+		file.seekp(static_cast<std::streamoff>(entry.offset));
+		file.write(garbage.data(), static_cast<std::streamsize>(garbage.size()));
+	}
+
+	EXPECT_NE(RunHamArc({"--verify", "-f", archive_.string()}), 0);
+	EXPECT_NE(RunHamArc({"-x", "-f", archive_.string()}, work_ / "out"), 0);
+	EXPECT_FALSE(fs::exists(work_ / "out" / "text.log"));
+
+	hamarc::ArchiveState state;
+	state.archivePath = archive_.string();
+	ASSERT_TRUE(hamarc::LoadArchive(state));
+	const fs::path range = work_ / "range.bin";
+	EXPECT_FALSE(hamarc::ExtractRange(state, "text.log", 10, 20, range.string()));
+	EXPECT_FALSE(fs::exists(range));
+}
+
+TEST_F(HamArcTest, DeflateExtractsARangeInsideAMember) {
+	if (!hamarc::IsCompressionAvailable(hamarc::kCompressionDeflate)) {
+		GTEST_SKIP() << "built without zlib";
+	}
+	std::vector<char> data = TextData(3 * (1 << 20));
+	const std::vector<char> noise = RandomData(1 << 20, 111);
+	std::copy(noise.begin(), noise.end(), data.begin() + (1 << 20));
+	const fs::path file = MakeFile("mixed.bin", data);
+	ASSERT_EQ(RunHamArc({"-c", "-f", archive_.string(), "--compress", "deflate", file.string()}), 0);
+
+	hamarc::ArchiveState state;
+	state.archivePath = archive_.string();
+	ASSERT_TRUE(hamarc::LoadArchive(state));
+	const fs::path range = work_ / "range.bin";
+	const std::vector<std::pair<unsigned long long, unsigned long long>> ranges = {
+		{0, 1},
+		{(1 << 20) - 7, (1 << 20) + 7},
+		{(1 << 20) + 12345, 2 * (1 << 20) + 999},
+		{data.size() - 5, ~0ULL},
+	};
+	for (const auto& [start, end] : ranges) {
+		ASSERT_TRUE(hamarc::ExtractRange(state, "mixed.bin", start, end, range.string())) << start;
+		const std::size_t stop = static_cast<std::size_t>(std::min<unsigned long long>(end, data.size()));
+		EXPECT_EQ(ReadBytes(range), std::vector<char>(data.begin() + start, data.begin() + stop)) << start;
+	}
+}
+
+#ifdef HAMARC_TEST_NOZLIB
+// Built against hamarc_core_nozlib, which has no zlib; the hamarc
+// executable the CLI helpers run may still have it.
+TEST_F(HamArcTest, WithoutZlibDeflateIsUnavailable) {
+	EXPECT_TRUE(hamarc::IsCompressionAvailable(hamarc::kCompressionNone));
+	EXPECT_FALSE(hamarc::IsCompressionAvailable(hamarc::kCompressionDeflate));
+
+	const fs::path file = MakeFile("file.bin", RandomData(5000, 112));
+	hamarc::CreateOptions options;
+	options.compression = hamarc::kCompressionDeflate;
+	EXPECT_FALSE(hamarc::CreateArchive(archive_.string(), {file.string()}, options));
+	EXPECT_FALSE(fs::exists(archive_));
+
+	ASSERT_TRUE(hamarc::CreateArchive(archive_.string(), {file.string()}));
+	hamarc::ArchiveState state;
+	state.archivePath = archive_.string();
+	ASSERT_TRUE(hamarc::LoadArchive(state));
+	ASSERT_TRUE(hamarc::ExtractFile(state, "file.bin", (work_ / "out" / "file.bin").string()));
+	EXPECT_TRUE(FilesEqual(file, work_ / "out" / "file.bin"));
+}
+
+TEST_F(HamArcTest, WithoutZlibDeflatedMembersFailCleanly) {
+	const fs::path deflated = MakeFile("deflated.log", TextData(50000));
+	const fs::path plain = MakeFile("plain.bin", RandomData(5000, 113));
+	if (RunHamArc({"-c", "-f", archive_.string(), "--compress", "deflate", deflated.string()}) != 0) {
+		GTEST_SKIP() << "the hamarc executable is built without zlib too";
+	}
+	const std::vector<char> created = ReadBytes(archive_);
+	hamarc::ArchiveState state;
+	state.archivePath = archive_.string();
+	ASSERT_TRUE(hamarc::LoadArchive(state));
+	// Appends use the archive's compression, so they fail and leave it as it was.
+	EXPECT_FALSE(hamarc::AppendFile(state, plain.string()));
+	EXPECT_EQ(ReadBytes(archive_), created);
+
+	ASSERT_TRUE(hamarc::LoadArchive(state));
+	EXPECT_FALSE(hamarc::ExtractFile(state, "deflated.log", (work_ / "out" / "deflated.log").string()));
+	EXPECT_FALSE(fs::exists(work_ / "out" / "deflated.log"));
+	EXPECT_FALSE(hamarc::ExtractAll(state, (work_ / "out").string(), 2));
+	EXPECT_FALSE(fs::exists(work_ / "out" / "deflated.log"));
+
+	hamarc::VerifyReport report;
+	ASSERT_TRUE(hamarc::VerifyArchive(state, report));
+	EXPECT_EQ(report.failed, std::vector<std::string>{"deflated.log"});
+}
+#endif
+
+TEST_F(HamArcTest, ExtractRangeClampsToTheMember) {
+	const std::vector<char> data = RandomData(10000, 130);
+	const fs::path file = MakeFile("file.bin", data);
+	ASSERT_EQ(RunHamArc({"-c", "-f", archive_.string(), file.string()}), 0);
+
+	hamarc::ArchiveState state;
+	state.archivePath = archive_.string();
+	ASSERT_TRUE(hamarc::OpenArchive(state));
+	const fs::path range = work_ / "range.bin";
+	const std::vector<std::pair<unsigned long long, unsigned long long>> empty_ranges = {
+		{20000, 30000}, {10000, ~0ULL}, {500, 500}, {0, 0},
+	};
+	for (const auto& [start, end] : empty_ranges) {
+		ASSERT_TRUE(hamarc::ExtractRange(state, "file.bin", start, end, range.string())) << start << ":" << end;
+		EXPECT_TRUE(fs::exists(range));
+		EXPECT_EQ(fs::file_size(range), 0u) << start << ":" << end;
+	}
+	ASSERT_TRUE(hamarc::ExtractRange(state, "file.bin", 9990, 20000, range.string()));
+	EXPECT_EQ(ReadBytes(range), std::vector<char>(data.end() - 10, data.end()));
+	EXPECT_FALSE(hamarc::ExtractRange(state, "missing.bin", 0, 10, range.string()));
+}
+
+TEST_F(HamArcTest, ExtractRangeCrossesInterleaveGroups) {
+	const std::vector<char> data = RandomData(2 * (1 << 20) + 321, 131);
+	const fs::path file = MakeFile("file.bin", data);
+	for (std::string codec : {"hamming84", "secded72"}) {
+		for (unsigned depth : {8u, 64u}) {
+			ASSERT_EQ(RunHamArc({"-c", "-f", archive_.string(), "--codec", codec, "--interleave",
+			                     std::to_string(depth), file.string()}), 0);
+			hammingcoder::StreamOptions options;
+			options.codec = hammingcoder::FindCodec(codec)->Id();
+			options.interleave = depth;
+			options.block_size = 1;
+			const std::size_t group = hammingcoder::AlignedBlockSize(options);
+			ASSERT_GT(group, 1u);
+
+			hamarc::ArchiveState state;
+			state.archivePath = archive_.string();
+			ASSERT_TRUE(hamarc::OpenArchive(state));
+			const fs::path range = work_ / "range.bin";
+			const std::vector<std::pair<std::size_t, std::size_t>> ranges = {
+				{group - 1, group + 1},
+				{3 * group - 5, 7 * group + 3},
+				{(1 << 20) - 3, (1 << 20) + group + 3},
+				{data.size() - group - 2, data.size()},
+			};
+			for (const auto& [start, end] : ranges) {
+				ASSERT_TRUE(hamarc::ExtractRange(state, "file.bin", start, end, range.string()))
+					<< codec << "/" << depth << " " << start;
+				EXPECT_EQ(ReadBytes(range), std::vector<char>(data.begin() + start, data.begin() + end))
+					<< codec << "/" << depth << " " << start;
+			}
+		}
+	}
+}
+
+TEST_F(HamArcTest, RangeOptionParsesOpenEndsAndRejectsMalformedRanges) {
+	const std::vector<char> data = RandomData(5000, 132);
+	const fs::path file = MakeFile("file.bin", data);
+	ASSERT_EQ(RunHamArc({"-c", "-f", archive_.string(), file.string()}), 0);
+	const fs::path out = work_ / "out" / "out";
+
+	const std::vector<std::pair<std::string, std::pair<std::size_t, std::size_t>>> valid = {
+		{"100:200", {100, 200}},
+		{"4990:", {4990, 5000}},
+		{":10", {0, 10}},
+		{"4000", {4000, 5000}},
+		{"300:300", {300, 300}},
+		{"6000:7000", {5000, 5000}},
+	};
+	for (const auto& [range, expected] : valid) {
+		fs::remove(out);
+		ASSERT_EQ(RunHamArc({"-x", "-f", archive_.string(), "--range", range, "file.bin"}, work_ / "out"), 0) << range;
+		EXPECT_EQ(ReadBytes(out), std::vector<char>(data.begin() + expected.first, data.begin() + expected.second))
+			<< range;
+	}
+
+	for (std::string range : {"abc", "5:3", "1:2:3", "-1:5", "10:x", " 1:2", "99999999999999999999:"}) {
+		fs::remove(out);
+		EXPECT_NE(RunHamArc({"-x", "-f", archive_.string(), "--range", range, "file.bin"}, work_ / "out"), 0) << range;
+		EXPECT_FALSE(fs::exists(out)) << range;
+	}
+
+	// A range applies to named members only; without one nothing is extracted.
+	fs::remove(out);
+	for (std::string range : {"100:200", "garbage"}) {
+		EXPECT_NE(RunHamArc({"-x", "-f", archive_.string(), "--range", range}, work_ / "out"), 0) << range;
+		EXPECT_TRUE(fs::is_empty(work_ / "out")) << range;
+	}
+}
@@ -0,0 +1,549 @@
+#include <gtest/gtest.h>
+#include "hamming.h"
+#include "checksum.h"
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstring>
+#include <span>
+
+static std::vector<char> RandomBytes(std::mt19937& rng, std::size_t size) {
+	std::uniform_int_distribution<int> dist(0, 255);
+	std::vector<char> data(size);
+	for (char& c : data) c = static_cast<char>(dist(rng));
+	return data;
+}
+
+static void FlipRandomBits(std::mt19937& rng, std::vector<char>& data, std::size_t count) {
+	if (data.empty()) return;
+	std::uniform_int_distribution<std::size_t> pos(0, data.size() * 8 - 1);
+	for (std::size_t i = 0; i < count; i++) {
+		std::size_t bit = pos(rng);
+		data[bit / 8] ^= static_cast<char>(1 << (bit % 8));
+	}
+}
+
+class KernelGuard {
+public:
+	KernelGuard() : saved_(hammingcoder::ActiveKernel()) {}
+	~KernelGuard() { hammingcoder::SelectKernel(saved_); }
+private:
+	hammingcoder::Kernel saved_;
+};
+
+static const hammingcoder::Kernel kAllKernels[] = {
+	hammingcoder::kKernelScalar,
+	hammingcoder::kKernelSse41,
+	hammingcoder::kKernelAvx2,
+	hammingcoder::kKernelAvx512
+};
+
+TEST(HammingCodec, RoundTripEveryByte) {
+	for (int b = 0; b < 256; b++) {
+		auto code = hammingcoder::CodeByte(static_cast<char>(b));
+		bool s, d, p;
+		char decoded = hammingcoder::DecodeByte(code.first, code.second, s, d, p);
+		EXPECT_EQ(static_cast<unsigned char>(decoded), b);
+		EXPECT_FALSE(s);
+		EXPECT_FALSE(d);
+	}
+}
+
+TEST(HammingCodec, CorrectsEverySingleBitFlip) {
+	for (int b = 0; b < 256; b++) {
+		auto code = hammingcoder::CodeByte(static_cast<char>(b));
+		for (int bit = 0; bit < 8; bit++) {
+			bool s, d, p;
+			char decoded = hammingcoder::DecodeByte(static_cast<char>(code.first ^ (1 << bit)), code.second, s, d, p);
+			EXPECT_EQ(static_cast<unsigned char>(decoded), b);
+			EXPECT_TRUE(s);
+			EXPECT_FALSE(d);
+		}
+	}
+}
+
+TEST(HammingCodec, DetectsEveryDoubleBitFlip) {
+	for (int b = 0; b < 256; b++) {
+		auto code = hammingcoder::CodeByte(static_cast<char>(b));
+		for (int x = 0; x < 8; x++) {
+			for (int y = x + 1; y < 8; y++) {
+				bool s, d, p;
+				hammingcoder::DecodeByte(code.first, static_cast<char>(code.second ^ (1 << x) ^ (1 << y)), s, d, p);
+				EXPECT_FALSE(s);
+				EXPECT_TRUE(d);
+			}
+		}
+	}
+}
+
+TEST(HammingCodec, EveryKernelClassifiesParityAndDoubleFlips) {
+	KernelGuard guard;
+	std::mt19937 rng(707);
+	std::vector<char> data = RandomBytes(rng, 4096);
+	std::vector<char> encoded = hammingcoder::EncodeBuffer(data.data(), data.size());
+
+	encoded[20] ^= static_cast<char>(0x80);    // parity bit only, corrected
+	encoded[1001] ^= 0x02;                     // data bit, corrected
+	encoded[3000] ^= 0x11;                     // double flip, uncorrectable
+	encoded[5000] ^= 0x04;                     // one half corrected, the other
+	encoded[5001] ^= 0x60;                     // uncorrectable: the pair is lost
+	encoded[8190] ^= static_cast<char>(0x81);  // data and parity bit, uncorrectable
+
+	for (auto kernel : kAllKernels) {
+		if (!hammingcoder::SelectKernel(kernel)) continue;
+		int correct = 0, uncorrect = 0;
+		std::vector<char> decoded = hammingcoder::DecodeBuffer(encoded.data(), encoded.size(), correct, uncorrect);
+		EXPECT_EQ(correct, 2) << "kernel " << kernel;
+		EXPECT_EQ(uncorrect, 3) << "kernel " << kernel;
+		EXPECT_EQ(decoded[10], data[10]) << "kernel " << kernel;
+		EXPECT_EQ(decoded[500], data[500]) << "kernel " << kernel;
+	}
+}
+
+TEST(HammingCodec, KernelsMatchScalarEncode) {
+	KernelGuard guard;
+	std::mt19937 rng(12345);
+	const std::size_t sizes[] = {0, 1, 15, 16, 17, 31, 63, 64, 65, 127, 1000, 4096 + 77};
+
+	for (std::size_t size : sizes) {
+		std::vector<char> data = RandomBytes(rng, size);
+		ASSERT_TRUE(hammingcoder::SelectKernel(hammingcoder::kKernelScalar));
+		std::vector<char> expected = hammingcoder::EncodeBuffer(data.data(), data.size());
+
+		for (auto kernel : kAllKernels) {
+			if (!hammingcoder::SelectKernel(kernel)) continue;
+			EXPECT_EQ(hammingcoder::EncodeBuffer(data.data(), data.size()), expected)
+				<< "kernel " << kernel << ", size " << size;
+		}
+	}
+}
+
+TEST(HammingCodec, KernelsMatchScalarDecodeWithBitFlips) {
+	KernelGuard guard;
+	std::mt19937 rng(54321);
+	const std::size_t sizes[] = {1, 16, 33, 64, 129, 1000, 65536 + 5};
+	const std::size_t flips[] = {0, 1, 10, 500};
+
+	for (std::size_t size : sizes) {
+		for (std::size_t flip_count : flips) {
+			std::vector<char> data = RandomBytes(rng, size);
+			std::vector<char> encoded = hammingcoder::EncodeBuffer(data.data(), data.size());
+			FlipRandomBits(rng, encoded, flip_count);
+
+			ASSERT_TRUE(hammingcoder::SelectKernel(hammingcoder::kKernelScalar));
+			int expected_correct = 0, expected_uncorrect = 0;
+			std::vector<char> expected = hammingcoder::DecodeBuffer(encoded.data(), encoded.size(),
+			                                                        expected_correct, expected_uncorrect);
+			if (flip_count == 0) {
+				EXPECT_EQ(expected, data);
+			}
+
+			for (auto kernel : kAllKernels) {
+				if (!hammingcoder::SelectKernel(kernel)) continue;
+				int correct = 0, uncorrect = 0;
+				std::vector<char> decoded = hammingcoder::DecodeBuffer(encoded.data(), encoded.size(),
+				                                                       correct, uncorrect);
+				EXPECT_EQ(decoded, expected) << "kernel " << kernel << ", size " << size;
+				EXPECT_EQ(correct, expected_correct) << "kernel " << kernel << ", size " << size;
+				EXPECT_EQ(uncorrect, expected_uncorrect) << "kernel " << kernel << ", size " << size;
+			}
+		}
+	}
+}
+
+TEST(HammingCodec, ExhaustivePairsMatchAcrossKernels) {
+	KernelGuard guard;
+	std::vector<char> encoded;
+	encoded.reserve(2 * 65536);
+	for (int first = 0; first < 256; first++) {
+		for (int second = 0; second < 256; second++) {
+			encoded.push_back(static_cast<char>(first));
+			encoded.push_back(static_cast<char>(second));
+		}
+	}
+
+	ASSERT_TRUE(hammingcoder::SelectKernel(hammingcoder::kKernelScalar));
+	int expected_correct = 0, expected_uncorrect = 0;
+	std::vector<char> expected = hammingcoder::DecodeBuffer(encoded.data(), encoded.size(),
+	                                                        expected_correct, expected_uncorrect);
+
+	for (auto kernel : kAllKernels) {
+		if (!hammingcoder::SelectKernel(kernel)) continue;
+		int correct = 0, uncorrect = 0;
+		EXPECT_EQ(hammingcoder::DecodeBuffer(encoded.data(), encoded.size(), correct, uncorrect), expected)
+			<< "kernel " << kernel;
+		EXPECT_EQ(correct, expected_correct);
+		EXPECT_EQ(uncorrect, expected_uncorrect);
+	}
+}
+
+TEST(HammingStream, ThreadCountsProduceIdenticalOutput) {
+	std::mt19937 rng(777);
+	std::vector<char> data = RandomBytes(rng, 3 * 4096 + 123);
+	std::vector<char> expected = hammingcoder::EncodeBuffer(data.data(), data.size());
+	std::vector<char> damaged = expected;
+	FlipRandomBits(rng, damaged, 40);
+
+	int expected_correct = 0, expected_uncorrect = 0;
+	std::vector<char> expected_decoded = hammingcoder::DecodeBuffer(damaged.data(), damaged.size(),
+	                                                                expected_correct, expected_uncorrect);
+
+	for (unsigned threads : {1u, 2u, 3u, 8u}) {
+		hammingcoder::StreamOptions options;
+		options.threads = threads;
+		options.block_size = 4096;
+
+		std::istringstream in(std::string(data.begin(), data.end()));
+		std::ostringstream out;
+		hammingcoder::EncodeStream(in, out, nullptr, options);
+		std::string encoded = out.str();
+		EXPECT_EQ(std::vector<char>(encoded.begin(), encoded.end()), expected) << threads << " threads";
+
+		std::istringstream damaged_in(std::string(damaged.begin(), damaged.end()));
+		std::ostringstream decoded_out;
+		int correct = 0, uncorrect = 0;
+		hammingcoder::DecodeStream(damaged_in, decoded_out, correct, uncorrect, options);
+		std::string decoded = decoded_out.str();
+		EXPECT_EQ(std::vector<char>(decoded.begin(), decoded.end()), expected_decoded) << threads << " threads";
+		EXPECT_EQ(correct, expected_correct);
+		EXPECT_EQ(uncorrect, expected_uncorrect);
+	}
+}
+
+TEST(HammingCodec, IntoSpansMatchesBufferApi) {
+	std::mt19937 rng(4242);
+	std::vector<char> data = RandomBytes(rng, 777);
+	std::vector<char> expected = hammingcoder::EncodeBuffer(data.data(), data.size());
+
+	std::vector<std::byte> encoded(2 * data.size());
+	auto input = std::as_bytes(std::span(data));
+	EXPECT_EQ(hammingcoder::EncodeInto(input, std::span(encoded).first(encoded.size() - 1)), 0u);
+	ASSERT_EQ(hammingcoder::EncodeInto(input, encoded), expected.size());
+	EXPECT_EQ(std::memcmp(encoded.data(), expected.data(), expected.size()), 0);
+
+	encoded[10] ^= std::byte{0x04};
+	std::vector<std::byte> decoded(data.size());
+	std::size_t correct = 5, uncorrect = 0;
+	ASSERT_EQ(hammingcoder::DecodeInto(encoded, decoded, correct, uncorrect), data.size());
+	EXPECT_EQ(std::memcmp(decoded.data(), data.data(), data.size()), 0);
+	EXPECT_EQ(correct, 6u);
+	EXPECT_EQ(uncorrect, 0u);
+}
+
+TEST(HammingStream, ReportLocatesUncorrectablePairs) {
+	std::mt19937 rng(99);
+	std::vector<char> data = RandomBytes(rng, 10000);
+	std::vector<char> encoded = hammingcoder::EncodeBuffer(data.data(), data.size());
+
+	encoded[7] ^= 0x01;                    // single flip, corrected
+	encoded[4000] ^= 0x03;                 // double flip in pair 2000
+	encoded[4003] ^= 0x05;                 // double flip in pair 2001, merges with the previous one
+	encoded[19998] ^= 0x30;                // double flip in the last pair
+
+	for (unsigned threads : {1u, 4u}) {
+		hammingcoder::StreamOptions options;
+		options.threads = threads;
+		options.block_size = 1000;
+
+		std::istringstream in(std::string(encoded.begin(), encoded.end()));
+		std::ostringstream out;
+		hammingcoder::DecodeReport report;
+		hammingcoder::DecodeStream(in, out, report, options);
+
+		EXPECT_EQ(report.corrected, 1u);
+		EXPECT_EQ(report.uncorrectable, 3u);
+		ASSERT_EQ(report.damaged.size(), 2u);
+		EXPECT_EQ(report.damaged[0].offset, 4000u);
+		EXPECT_EQ(report.damaged[0].length, 4u);
+		EXPECT_EQ(report.damaged[1].offset, 19998u);
+		EXPECT_EQ(report.damaged[1].length, 2u);
+	}
+}
+
+TEST(HammingStream, ProgressReportsTotalsAndCounts) {
+	std::mt19937 rng(31337);
+	std::vector<char> data = RandomBytes(rng, 50000);
+	std::vector<char> encoded = hammingcoder::EncodeBuffer(data.data(), data.size());
+	encoded[10] ^= 0x04;
+	encoded[60001] ^= 0x11;
+
+	hammingcoder::StreamOptions options;
+	options.threads = 2;
+	options.block_size = 4096;
+	options.progress_interval = std::chrono::milliseconds(0);
+	std::vector<hammingcoder::StreamProgress> calls;
+	options.progress = [&](const hammingcoder::StreamProgress& progress) { calls.push_back(progress); };
+
+	std::istringstream in(std::string(data.begin(), data.end()));
+	std::ostringstream out;
+	size_t legacy_total = 0;
+	hammingcoder::EncodeStream(in, out, [&](size_t, size_t total) { legacy_total = total; }, options);
+	EXPECT_EQ(legacy_total, data.size());
+	ASSERT_GT(calls.size(), 1u);
+	EXPECT_TRUE(calls.back().finished);
+	EXPECT_EQ(calls.back().bytes_done, data.size());
+	EXPECT_EQ(calls.back().bytes_total, data.size());
+	for (size_t i = 1; i < calls.size(); i++) {
+		EXPECT_GE(calls[i].bytes_done, calls[i - 1].bytes_done);
+	}
+
+	calls.clear();
+	std::istringstream damaged_in(std::string(encoded.begin(), encoded.end()));
+	std::ostringstream decoded_out;
+	hammingcoder::DecodeReport report;
+	hammingcoder::DecodeStream(damaged_in, decoded_out, report, options);
+	ASSERT_FALSE(calls.empty());
+	EXPECT_TRUE(calls.back().finished);
+	EXPECT_EQ(calls.back().bytes_done, encoded.size());
+	EXPECT_EQ(calls.back().bytes_total, encoded.size());
+	EXPECT_EQ(calls.back().corrected, report.corrected);
+	EXPECT_EQ(calls.back().uncorrectable, report.uncorrectable);
+	EXPECT_EQ(report.corrected, 1u);
+	EXPECT_EQ(report.uncorrectable, 1u);
+}
+
+TEST(SecdedCodec, CorrectsSingleAndDetectsDoubleFlips) {
+	const hammingcoder::Codec& codec = hammingcoder::GetCodec(hammingcoder::kCodecSecded7264);
+	ASSERT_EQ(codec.Id(), hammingcoder::kCodecSecded7264);
+
+	std::mt19937 rng(2024);
+	std::vector<char> data = RandomBytes(rng, 8);
+	std::vector<std::byte> clean(9);
+	ASSERT_EQ(codec.EncodeInto(std::as_bytes(std::span(data)), clean), 9u);
+
+	std::vector<std::byte> decoded(8);
+	for (int bit = 0; bit < 72; bit++) {
+		std::vector<std::byte> code = clean;
+		code[bit / 8] ^= std::byte(1 << (bit % 8));
+		hammingcoder::DecodeReport report;
+		ASSERT_EQ(codec.DecodeInto(code, decoded, report), 8u);
+		EXPECT_EQ(std::memcmp(decoded.data(), data.data(), 8), 0) << "bit " << bit;
+		EXPECT_EQ(report.corrected, 1u);
+		EXPECT_EQ(report.uncorrectable, 0u);
+	}
+
+	for (int a = 0; a < 72; a++) {
+		for (int b = a + 1; b < 72; b++) {
+			std::vector<std::byte> code = clean;
+			code[a / 8] ^= std::byte(1 << (a % 8));
+			code[b / 8] ^= std::byte(1 << (b % 8));
+			hammingcoder::DecodeReport report;
+			codec.DecodeInto(code, decoded, report, 90);
+			EXPECT_EQ(report.uncorrectable, 1u) << "bits " << a << ", " << b;
+			ASSERT_EQ(report.damaged.size(), 1u);
+			EXPECT_EQ(report.damaged[0].offset, 90u);
+			EXPECT_EQ(report.damaged[0].length, 9u);
+		}
+	}
+}
+
+TEST(SecdedCodec, StreamRoundTripPadsToWholeWords) {
+	std::mt19937 rng(31337);
+	std::vector<char> data = RandomBytes(rng, 5000 + 3);
+
+	hammingcoder::StreamOptions options;
+	options.codec = hammingcoder::kCodecSecded7264;
+	options.block_size = 1000;
+	options.threads = 3;
+
+	std::istringstream in(std::string(data.begin(), data.end()));
+	std::ostringstream out;
+	hammingcoder::EncodeStream(in, out, nullptr, options);
+	std::string encoded = out.str();
+	const hammingcoder::Codec& codec = hammingcoder::GetCodec(options.codec);
+	ASSERT_EQ(encoded.size(), codec.EncodedSize(data.size()));
+
+	encoded[17] ^= 0x10;
+	std::istringstream encoded_in(encoded);
+	std::ostringstream decoded_out;
+	hammingcoder::DecodeReport report;
+	hammingcoder::DecodeStream(encoded_in, decoded_out, report, options);
+	std::string decoded = decoded_out.str();
+
+	ASSERT_EQ(decoded.size(), (data.size() + 7) / 8 * 8);
+	EXPECT_EQ(decoded.substr(0, data.size()), std::string(data.begin(), data.end()));
+	EXPECT_EQ(report.corrected, 1u);
+	EXPECT_EQ(report.uncorrectable, 0u);
+}
+
+static void FlipBurst(std::string& data, std::size_t first_bit, std::size_t length) {
+	for (std::size_t bit = first_bit; bit < first_bit + length; bit++) {
+		data[bit / 8] ^= static_cast<char>(1 << (bit % 8));
+	}
+}
+
+TEST(Interleave, DeinterleaveRestoresCodewords) {
+	std::mt19937 rng(8);
+	for (std::size_t codeword : {1u, 9u}) {
+		for (unsigned depth : {8u, 16u, 32u, 64u}) {
+			std::vector<char> data = RandomBytes(rng, 3 * depth * codeword);
+			std::vector<std::byte> bytes(data.size());
+			std::memcpy(bytes.data(), data.data(), data.size());
+
+			hammingcoder::Interleave(bytes, codeword, depth);
+			EXPECT_NE(std::memcmp(bytes.data(), data.data(), data.size()), 0);
+			hammingcoder::Deinterleave(bytes, codeword, depth);
+			EXPECT_EQ(std::memcmp(bytes.data(), data.data(), data.size()), 0) << codeword << "x" << depth;
+		}
+	}
+}
+
+TEST(Interleave, SurvivesBurstsUpToDepth) {
+	std::mt19937 rng(1234);
+	std::vector<char> data = RandomBytes(rng, 20000 + 11);
+	const std::string original(data.begin(), data.end());
+
+	for (auto codec : {hammingcoder::kCodecHamming84, hammingcoder::kCodecSecded7264}) {
+		for (unsigned depth : {8u, 16u, 32u, 64u}) {
+			hammingcoder::StreamOptions options;
+			options.codec = codec;
+			options.interleave = depth;
+			options.block_size = 4096;
+			options.threads = 2;
+
+			std::istringstream in(original);
+			std::ostringstream out;
+			hammingcoder::EncodeStream(in, out, nullptr, options);
+			std::string encoded = out.str();
+			ASSERT_EQ(encoded.size(), hammingcoder::EncodedStreamSize(original.size(), options));
+
+			// One burst in the first half of each fifth, so no two share a group.
+			const std::size_t segment = encoded.size() * 8 / 5;
+			std::uniform_int_distribution<std::size_t> start(0, segment / 2);
+			for (std::size_t burst = 0; burst < 5; burst++) {
+				FlipBurst(encoded, burst * segment + start(rng), depth);
+			}
+
+			std::istringstream encoded_in(encoded);
+			std::ostringstream decoded_out;
+			hammingcoder::DecodeReport report;
+			hammingcoder::DecodeStream(encoded_in, decoded_out, report, options);
+			EXPECT_EQ(report.uncorrectable, 0u) << "codec " << codec << ", depth " << depth;
+			EXPECT_EQ(decoded_out.str().substr(0, original.size()), original) << "codec " << codec << ", depth " << depth;
+		}
+	}
+}
+
+TEST(Interleave, BurstBreaksPlainEncoding) {
+	std::mt19937 rng(5);
+	std::vector<char> data = RandomBytes(rng, 1000);
+	std::string encoded = [&] {
+		std::vector<char> e = hammingcoder::EncodeBuffer(data.data(), data.size());
+		return std::string(e.begin(), e.end());
+	}();
+	FlipBurst(encoded, 802, 2);
+
+	std::istringstream in(encoded);
+	std::ostringstream out;
+	hammingcoder::DecodeReport report;
+	hammingcoder::DecodeStream(in, out, report);
+	EXPECT_GT(report.uncorrectable, 0u);
+}
+
+TEST(Scrub, RepairRestoresCorrectableCodewordsOnly) {
+	std::mt19937 rng(77);
+	std::vector<char> data = RandomBytes(rng, 4000);
+	const std::vector<char> clean = hammingcoder::EncodeBuffer(data.data(), data.size());
+	std::vector<char> damaged = clean;
+
+	damaged[10] ^= 0x04;                   // single flips, rewritten
+	damaged[11] ^= 0x40;
+	damaged[3001] ^= 0x80;                 // parity bit only
+	damaged[5000] ^= 0x03;                 // double flip, left alone
+
+	std::vector<std::byte> bytes(damaged.size());
+	std::memcpy(bytes.data(), damaged.data(), damaged.size());
+	hammingcoder::DecodeReport report;
+	std::vector<hammingcoder::DamagedRange> repaired;
+	std::size_t rewritten = hammingcoder::RepairBlock(bytes, report, repaired, 100, {});
+
+	EXPECT_EQ(rewritten, 3u);
+	ASSERT_EQ(repaired.size(), 2u);
+	EXPECT_EQ(repaired[0].offset, 110u);
+	EXPECT_EQ(repaired[0].length, 2u);
+	EXPECT_EQ(repaired[1].offset, 3101u);
+	EXPECT_EQ(report.uncorrectable, 1u);
+	ASSERT_EQ(report.damaged.size(), 1u);
+	EXPECT_EQ(report.damaged[0].offset, 5100u);
+
+	damaged[5000] ^= 0x03;
+	for (std::size_t i = 0; i < clean.size(); i++) {
+		char expected = i == 5000 ? static_cast<char>(clean[i] ^ 0x03) : clean[i];
+		ASSERT_EQ(static_cast<char>(bytes[i]), expected) << "byte " << i;
+	}
+}
+
+TEST(Scrub, RepairHandlesInterleavedSecded) {
+	std::mt19937 rng(78);
+	std::vector<char> data = RandomBytes(rng, 9000);
+	hammingcoder::StreamOptions options;
+	options.codec = hammingcoder::kCodecSecded7264;
+	options.interleave = 16;
+
+	std::vector<std::byte> clean(hammingcoder::EncodedStreamSize(data.size(), options));
+	hammingcoder::EncodeBlock(std::as_bytes(std::span(data)), clean, options);
+	std::vector<std::byte> bytes = clean;
+	for (std::size_t i = 0; i < bytes.size(); i += 500) {
+		bytes[i] ^= std::byte{0x20};
+	}
+
+	hammingcoder::DecodeReport report;
+	std::vector<hammingcoder::DamagedRange> repaired;
+	hammingcoder::RepairBlock(bytes, report, repaired, 0, options);
+	EXPECT_EQ(report.uncorrectable, 0u);
+	EXPECT_GT(report.corrected, 0u);
+	EXPECT_TRUE(bytes == clean);
+
+	report = {};
+	repaired.clear();
+	EXPECT_EQ(hammingcoder::RepairBlock(bytes, report, repaired, 0, options), 0u);
+	EXPECT_TRUE(repaired.empty());
+}
+
+static std::uint64_t HashOf(const std::string& text) {
+	return hammingcoder::HashBytes(std::as_bytes(std::span(text.data(), text.size())));
+}
+
+TEST(Checksum, MatchesReferenceXxHash64) {
+	EXPECT_EQ(HashOf(""), 0xEF46DB3751D8E999ULL);
+	EXPECT_EQ(HashOf("a"), 0xD24EC4F1A98C6E5BULL);
+	EXPECT_EQ(HashOf("abc"), 0x44BC2CF5AD770999ULL);
+	EXPECT_EQ(HashOf("Nobody inspects the spammish repetition"), 0xFBCEA83C8A378BF1ULL);
+}
+
+TEST(Checksum, StreamingMatchesOneShot) {
+	std::mt19937 rng(79);
+	std::vector<char> data = RandomBytes(rng, 10000);
+	std::span<const std::byte> bytes = std::as_bytes(std::span(data));
+	const std::uint64_t expected = hammingcoder::HashBytes(bytes);
+
+	for (std::size_t piece : {1u, 7u, 31u, 32u, 33u, 4096u}) {
+		hammingcoder::XxHash64 hash;
+		for (std::size_t done = 0; done < bytes.size(); done += piece) {
+			hash.Update(bytes.subspan(done, std::min(piece, bytes.size() - done)));
+		}
+		EXPECT_EQ(hash.Digest(), expected) << "pieces of " << piece;
+	}
+}
+
+TEST(Checksum, EmptyUpdatesChangeNothing) {
+	std::mt19937 rng(80);
+	std::vector<char> data = RandomBytes(rng, 100);
+	std::span<const std::byte> bytes = std::as_bytes(std::span(data));
+
+	hammingcoder::XxHash64 empty;
+	empty.Update({});
+	EXPECT_EQ(empty.Digest(), HashOf(""));
+
+	// Before anything, with a partial stripe buffered, and after a whole one.
+	hammingcoder::XxHash64 hash;
+	hash.Update({});
+	hash.Update(bytes.first(5));
+	hash.Update({});
+	hash.Update(bytes.subspan(5, 59));
+	hash.Update(std::span<const std::byte>());
+	hash.Update(bytes.subspan(64));
+	EXPECT_EQ(hash.Digest(), hammingcoder::HashBytes(bytes));
+}